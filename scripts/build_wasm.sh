@@ -4,13 +4,13 @@ cd src/algorithm
 if [ $1 = "dev" ]
 then
     mkdir -p temp
-    make dev
+    make dev dev-simd dev-threads
     mv temp/* ../../public/js/
     rm -rf temp
 elif [ $1 = "prod" ]
 then
     mkdir -p temp
-    make prod
+    make prod prod-simd prod-threads
     cp temp/* ../../public/js/
     cd temp
     git init .
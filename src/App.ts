@@ -41,6 +41,7 @@ import GeneratedSchedule from './models/GeneratedSchedule';
 import { backend, runningOnElectron, version } from './config';
 import axios from 'axios';
 import { FastSearcher } from './algorithm/Searcher';
+import { loadRenderer } from './algorithm/Renderer';
 
 /** whether the version stored in localStorage matches the current version */
 const match = localStorage.getItem('version') === version;
@@ -111,6 +112,8 @@ export default class App extends Store {
         }
 
         window.NativeModule = await window.GetNative();
+        // the renderer is only needed once a schedule is displayed: start loading it now, without waiting for it
+        loadRenderer().catch(err => console.error(err));
 
         this.status.loading = true;
         const search = new URLSearchParams(window.location.search);
@@ -0,0 +1,31 @@
+#include "Capture.h"
+
+extern "C" {
+
+/**
+ * start or stop capturing the calls to the exported functions. Starting discards the previous trace,
+ * and so does stopping: read the trace with getCapture and getCaptureSize before that
+ */
+void setCapture(int enabled) {
+    Capture::trace.clear();
+    Capture::trace.shrink_to_fit();
+    Capture::enabled = enabled;
+    if (enabled) {
+        for (uint32_t x : {Capture::TRACE_MAGIC, Capture::TRACE_VERSION}) {
+            auto* data = reinterpret_cast<const uint8_t*>(&x);
+            Capture::trace.insert(Capture::trace.end(), data, data + 4);
+        }
+    }
+}
+
+/**
+ * @returns the trace captured so far. It is invalidated by the next exported call
+ */
+const uint8_t* getCapture() {
+    return Capture::trace.data();
+}
+
+int getCaptureSize() {
+    return Capture::trace.size();
+}
+}
@@ -0,0 +1,126 @@
+/**
+ * capture of the calls to the exported functions of the engines, so that slow sessions can be replayed natively
+ * (bench/replay.cpp). Capture is off until it is enabled with setCapture, and costs a branch per call otherwise.
+ *
+ * The trace starts with the uint32 TRACE_MAGIC and TRACE_VERSION, followed by one record per call:
+ * uint16 call id, uint32 length of the payload, and the payload, which are the arguments of the call in order (little endian):
+ * int32 for integers, float32 and float64 for floating point numbers, uint64 for searcher handles,
+ * and uint32 length followed by the bytes for buffers and strings. A call that creates a searcher is followed by
+ * a Call::result record with the handle it returned. Arguments are recorded before the call, as most functions free them
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Capture {
+
+/** "STRC" in little endian */
+constexpr uint32_t TRACE_MAGIC = 0x43525453;
+constexpr uint32_t TRACE_VERSION = 1;
+
+/** the ids of the recorded calls. Only append to this list, so that old traces can be replayed */
+enum class Call : uint16_t {
+    result = 0,
+    // Renderer.cpp
+    setOptions,
+    compute,
+    computeDays,
+    // ScheduleGenerator.cpp
+    generate,
+    sort,
+    setSortMode,
+    setSortOption,
+    setTimeMatrix,
+    setRefSchedule,
+    // Searcher.cpp
+    getSearcher,
+    getSearcherPacked,
+    getMultiFieldSearcher,
+    deleteSearcher,
+    sWSearch,
+    findBestMatch,
+    substringSearch,
+    addSentences,
+    updateSentence,
+    removeSentence,
+    compactSearcher,
+    setTypoTolerance,
+    setNumThreads,
+    // ThreadPool.cpp
+    setPoolSize
+};
+
+/** one copy per module, shared by the engines linked into it, so each module captures its own calls. The exported functions that read them are in Capture.cpp */
+inline bool enabled = false;
+inline std::vector<uint8_t> trace;
+
+/** a buffer argument */
+struct Bytes {
+    const void* data;
+    uint32_t size;
+};
+
+template <typename T>
+inline Bytes bytes(const T* data, int count) {
+    return {data, static_cast<uint32_t>(count * sizeof(T))};
+}
+
+inline Bytes str(const char* s) {
+    return {s, static_cast<uint32_t>(strlen(s))};
+}
+
+/** a searcher handle argument */
+struct Handle {
+    const void* ptr;
+};
+
+/**
+ * one record of the trace: `if (Capture::Record rec{Call::x}) rec << arg1 << arg2;`.
+ * Its payload length is written when it goes out of scope
+ */
+class Record {
+public:
+    explicit Record(Call call) : start(enabled ? trace.size() : 0) {
+        if (!enabled) return;
+        write(static_cast<uint16_t>(call));
+        write(uint32_t(0));
+    }
+    ~Record() {
+        if (!enabled) return;
+        const uint32_t length = trace.size() - start - 6;
+        memcpy(trace.data() + start + 2, &length, 4);
+    }
+    explicit operator bool() const { return enabled; }
+
+    Record& operator<<(int x) { return write(static_cast<int32_t>(x)); }
+    Record& operator<<(float x) { return write(x); }
+    Record& operator<<(double x) { return write(x); }
+    Record& operator<<(Handle h) { return write(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(h.ptr))); }
+    Record& operator<<(Bytes b) {
+        write(b.size);
+        auto* data = static_cast<const uint8_t*>(b.data);
+        trace.insert(trace.end(), data, data + b.size);
+        return *this;
+    }
+
+private:
+    size_t start;
+
+    template <typename T>
+    Record& write(T x) {
+        auto* data = reinterpret_cast<const uint8_t*>(&x);
+        trace.insert(trace.end(), data, data + sizeof(T));
+        return *this;
+    }
+};
+
+/**
+ * record the searcher created by the previous call
+ */
+inline void recordResult(const void* handle) {
+    if (Record rec{Call::result}) rec << Handle{handle};
+}
+
+}  // namespace Capture
@@ -0,0 +1,29 @@
+#include "Memory.h"
+
+extern "C" {
+
+/**
+ * @returns the memory used by the engines, see Memory.h
+ */
+const EngineMemory* getMemoryStats() {
+    return &Memory::memory;
+}
+
+/**
+ * set the memory budget of the engines of this module
+ * @param bytes the budget in bytes, or 0 to remove it
+ */
+void setMemoryBudget(double bytes) {
+    Memory::memory.budgetBytes = bytes > 0 ? static_cast<int64_t>(bytes) : 0;
+}
+
+/**
+ * reset the peaks to the current usage, and clear the degraded modes
+ */
+void resetMemoryPeak() {
+    auto& memory = Memory::memory;
+    memory.peakBytes = memory.currentBytes;
+    for (int i = 0; i < NUM_MEMORY_CATEGORIES; i++) memory.categoryPeakBytes[i] = memory.categoryBytes[i];
+    memory.degraded = 0;
+}
+}
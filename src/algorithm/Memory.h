@@ -0,0 +1,96 @@
+/**
+ * accounting of the memory of the engines, and a budget that they check before their large allocations.
+ * Each wasm module has its own accounting and budget: the host splits the budget between them.
+ * When an allocation does not fit in the budget, the engine degrades instead of failing:
+ * the generator keeps fewer schedules and evicts the cached coefficients of the sort functions that are not enabled,
+ * and the searchers stop caching results
+ *
+ * The host reads the EngineMemory returned by getMemoryStats directly: its layout is fixed, and fields are only appended
+ */
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdint.h>
+
+enum MemoryCategory {
+    // ScheduleGenerator.cpp
+    /** the sections of the generated schedules */
+    MEMORY_SCHEDULES,
+    /** indices, coefficients, offsets and time blocks of the schedules, see addToEval */
+    MEMORY_EVAL,
+    /** the cached coefficients of the sort functions */
+    MEMORY_SORT_COEFFS,
+    // Renderer.cpp
+    /** the blocks of each thread that computes blocks */
+    MEMORY_RENDER_BLOCKS,
+    // Searcher.cpp
+    /** the index of all searchers: arenas, gram, typo and suffix indices, and modifications */
+    MEMORY_SEARCH_INDEX,
+    /** the scratch memory of the queries of all searchers */
+    MEMORY_SEARCH_QUERY,
+    /** the cached results of all searchers */
+    MEMORY_SEARCH_CACHE,
+    NUM_MEMORY_CATEGORIES
+};
+
+/** the degraded modes that the engines entered since the last resetMemoryPeak, see EngineMemory.degraded */
+enum MemoryDegradation {
+    /** generate kept fewer schedules than requested */
+    MEMORY_FEWER_SCHEDULES = 1,
+    /** the coefficients of sort functions that are not enabled were evicted, and will be computed again when they are enabled */
+    MEMORY_EVICTED_COEFFS = 2,
+    /** the results of a query were not cached */
+    MEMORY_UNCACHED_RESULTS = 4
+};
+
+typedef struct EngineMemory {
+    int64_t currentBytes;
+    int64_t peakBytes;
+    /** 0 if there is no budget */
+    int64_t budgetBytes;
+    /** bitwise OR of MemoryDegradation */
+    int64_t degraded;
+    int64_t categoryBytes[NUM_MEMORY_CATEGORIES];
+    int64_t categoryPeakBytes[NUM_MEMORY_CATEGORIES];
+} EngineMemory;
+
+#ifdef __cplusplus
+namespace Memory {
+
+/** one copy per module, shared by the engines linked into it, with the share of the budget given to the module. The exported functions that read it are in Memory.cpp */
+inline EngineMemory memory;
+
+inline void raise(int64_t& peak, int64_t value) {
+    int64_t prev = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+    while (prev < value && !__atomic_compare_exchange_n(&peak, &prev, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+/**
+ * record that bytes were allocated (or freed, if negative) in a category
+ */
+inline void track(MemoryCategory category, int64_t bytes) {
+    if (bytes == 0) return;
+    raise(memory.categoryPeakBytes[category], __atomic_add_fetch(&memory.categoryBytes[category], bytes, __ATOMIC_RELAXED));
+    raise(memory.peakBytes, __atomic_add_fetch(&memory.currentBytes, bytes, __ATOMIC_RELAXED));
+}
+
+/**
+ * @returns the number of bytes that can still be allocated within the budget
+ */
+inline int64_t available() {
+    if (memory.budgetBytes <= 0) return INT64_MAX;
+    return memory.budgetBytes - __atomic_load_n(&memory.currentBytes, __ATOMIC_RELAXED);
+}
+
+inline bool fits(int64_t bytes) {
+    return bytes <= available();
+}
+
+inline void degrade(MemoryDegradation mode) {
+    __atomic_fetch_or(&memory.degraded, static_cast<int64_t>(mode), __ATOMIC_RELAXED);
+}
+
+}  // namespace Memory
+#endif
+
+#endif
@@ -8,6 +8,12 @@
 #include <queue>
 #include <vector>
 
+#include "Capture.h"
+#include "Memory.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+
 using namespace std;
 
 #define DOUBLE_EPS 1e-8
@@ -68,22 +74,24 @@ struct ScheduleBlock {
     vector<ScheduleBlock*> crightN;
 };
 
-ScheduleBlock* __restrict__ blocks = NULL;
+// the state below is per thread, so that computeDays can compute different days on different threads
+
+thread_local ScheduleBlock* __restrict__ blocks = NULL;
 // pointers to blocks, but may be reordered
 // never change the order of elements in blocks. Instead, change this variable
-ScheduleBlock** __restrict__ blocksReordered = NULL;
+thread_local ScheduleBlock** __restrict__ blocksReordered = NULL;
 // a working buffer for BFS/LP models, usually not full
-ScheduleBlock** __restrict__ blockBuffer = NULL;
+thread_local ScheduleBlock** __restrict__ blockBuffer = NULL;
 
-int* __restrict__ idxMap = NULL;
+thread_local int* __restrict__ idxMap = NULL;
 
 // --------- results -----------------
-double r_sum;
-double r_sumSq;
+thread_local double r_sum;
+thread_local double r_sumSq;
 // --------- results -----------------
 
-int maxN = 0;
-int N = 0;
+thread_local int maxN = 0;
+thread_local int N = 0;
 
 void computeResult() {
     for (int i = 0; i < N; i++) {
@@ -108,6 +116,7 @@ void sortByStartTime() {
  * @returns the total number of rooms
  */
 int intervalScheduling() {
+    Tracer::Span span{Tracer::Phase::intervalScheduling, N};
     if (N == 0) return 0;
 
     sortByStartTime();
@@ -145,6 +154,7 @@ int intervalScheduling() {
  * @returns the total number of rooms
  */
 int intervalScheduling2() {
+    Tracer::Span span{Tracer::Phase::intervalScheduling, N};
     if (N == 0) return 0;
 
     sortByStartTime();
@@ -188,9 +198,10 @@ struct TimeEntry {
  * to represent the conflicts between each pair of blocks
  */
 void constructAdjList(int total) {
+    Tracer::Span span{Tracer::Phase::adjacencyList, total};
     auto* grouped = new vector<ScheduleBlock*>[total];
     for (int i = 0; i < N; i++) {
-        grouped[blocks[i].depth].push_back(&blocks[i]);
+        grouped[blocks[i].depth].push_back(static_cast<ScheduleBlock*>(&blocks[i]));
     }
     for (int i = 0; i < total; i++) {
         sort(grouped[i].begin(), grouped[i].end(), [](ScheduleBlock* a, ScheduleBlock* b) { return a->startMin < b->startMin; });
@@ -298,6 +309,7 @@ bool DFSFindFixedNumerical(ScheduleBlock* start) {
 }
 
 void dfsWidthExpansion() {
+    Tracer::Span span{Tracer::Phase::dfsWidthExpansion, N};
     sort(blocksReordered, blocksReordered + N,
          [](const ScheduleBlock* b1, const ScheduleBlock* b2) {
              return b2->depth < b1->depth;
@@ -316,8 +328,8 @@ void dfsWidthExpansion() {
     }
 }
 
-vector<int> ia, ja;
-vector<double> ar;
+thread_local vector<int> ia, ja;
+thread_local vector<double> ar;
 
 inline void addConstraint(int auxVar, int structVar, double coeff) {
     ia.push_back(auxVar);
@@ -325,10 +337,22 @@ inline void addConstraint(int auxVar, int structVar, double coeff) {
     ar.push_back(coeff);
 }
 
+/**
+ * solve the LP with the simplex method, counting the calls and the iterations in the stats
+ */
+inline void simplex(glp_prob* lp) {
+    STATS_TIMER(simplexNs);
+    STATS_ADD(simplexCalls, 1);
+    STATS_ONLY(const int iterations = glp_get_it_cnt(lp));
+    glp_simplex(lp, &parm);
+    STATS_ADD(simplexIterations, glp_get_it_cnt(lp) - iterations);
+}
+
 #define L(x) 2 * (x) + 1
 #define W(x) 2 * (x) + 2
 
 void buildLPModel1(int NC) {
+    Tracer::Span span{Tracer::Phase::lp, NC};
     // map each event to an index (for structural vairable)
     for (int i = 0; i < NC; i++) {
         idxMap[blockBuffer[i]->idx] = i + 1;
@@ -339,6 +363,7 @@ void buildLPModel1(int NC) {
         for (auto v : blockBuffer[i]->cleftN)
             auxVar += !v->isFixed;
     glp_prob* lp = glp_create_prob();
+    STATS_ADD(lpProblems, 1);
     glp_set_obj_dir(lp, GLP_MAX);
 
     // preallocate rows and cols
@@ -383,7 +408,7 @@ void buildLPModel1(int NC) {
     glp_set_obj_coef(lp, NC + 1, 1.0);
 
     glp_load_matrix(lp, ia.size() - 1, ia.data(), ja.data(), ar.data());
-    glp_simplex(lp, &parm);
+    simplex(lp);
 
     double width = glp_get_col_prim(lp, NC + 1);
     for (int i = 0; i < NC; i++) {
@@ -395,6 +420,7 @@ void buildLPModel1(int NC) {
 
 #ifdef EXTRA_MODELS
 void buildLPModel2(int NC) {
+    Tracer::Span span{Tracer::Phase::lp, NC};
     for (int i = 0; i < NC; i++) {
         idxMap[blockBuffer[i]->idx] = 2 * i + 1;
     }
@@ -404,6 +430,7 @@ void buildLPModel2(int NC) {
         for (auto v : blockBuffer[i]->cleftN)
             auxVar += !v->isFixed;
     glp_prob* lp = glp_create_prob();
+    STATS_ADD(lpProblems, 1);
     glp_set_obj_dir(lp, GLP_MAX);
 
     // preallocate rows and cols
@@ -449,7 +476,7 @@ void buildLPModel2(int NC) {
     }
 
     glp_load_matrix(lp, ia.size() - 1, ia.data(), ja.data(), ar.data());
-    glp_simplex(lp, &parm);
+    simplex(lp);
 
     // ----------------- minimize absolute deviation from the mean -----------
     glp_set_obj_dir(lp, GLP_MIN);
@@ -482,7 +509,7 @@ void buildLPModel2(int NC) {
     glp_set_row_bnds(lp, auxVar, GLP_LO, sumWidth - DOUBLE_EPS, 0.0);
 
     glp_load_matrix(lp, ia.size() - 1, ia.data(), ja.data(), ar.data());
-    glp_simplex(lp, &parm);
+    simplex(lp);
     // ------------------------------------------------------------------
 
     for (int i = 0; i < NC; i++) {
@@ -524,6 +551,7 @@ void setupMinMAE(glp_prob* lp, int auxVar, const int MEAN_VAR, const int N) {
 }
 
 void buildLPModel3(int NC) {
+    Tracer::Span span{Tracer::Phase::lp, NC};
     for (int i = 0; i < NC; i++) {
         idxMap[blockBuffer[i]->idx] = 2 * i + 1;
     }
@@ -533,6 +561,7 @@ void buildLPModel3(int NC) {
         for (auto v : blockBuffer[i]->cleftN)
             auxVar += !v->isFixed;
     glp_prob* lp = glp_create_prob();
+    STATS_ADD(lpProblems, 1);
     glp_set_obj_dir(lp, GLP_MIN);
 
     // preallocate rows and cols
@@ -579,7 +608,7 @@ void buildLPModel3(int NC) {
     }
     setupMinMAE(lp, auxVar, MEAN_VAR, NC);
     glp_load_matrix(lp, ia.size() - 1, ia.data(), ja.data(), ar.data());
-    glp_simplex(lp, &parm);
+    simplex(lp);
 
     for (int i = 0; i < NC; i++) {
         blockBuffer[i]->left = glp_get_col_prim(lp, L(i));
@@ -589,6 +618,7 @@ void buildLPModel3(int NC) {
 }
 
 void buildMILPModel(int total) {
+    Tracer::Span span{Tracer::Phase::milp, N};
 #define B(x) 3 * N + (x) + 1
     // count the number of rows needed
     int auxVar = 0;
@@ -602,6 +632,7 @@ void buildMILPModel(int total) {
     }
     int numBV = auxVar;
     glp_prob* lp = glp_create_prob();
+    STATS_ADD(lpProblems, 1);
     glp_set_obj_dir(lp, GLP_MIN);
 
     // preallocate rows and cols
@@ -693,30 +724,15 @@ inline int getFixedCount(ScheduleBlock* end) {
     return fixedCount;
 }
 
-// disable name-mangling for exported functions
-extern "C" {
-
-void setOptions(int _isTolerance, int _ISMethod, int _applyDFS,
-                int _dfsTolerance, int _LPIters, int _LPModel, int _MILP, double _tFactor) {
-    isTolerance = _isTolerance;
-    ISMethod = _ISMethod;
-    applyDFS = _applyDFS;
-    dfsTolerance = _dfsTolerance;
-    LPIters = _LPIters;
-    LPModel = _LPModel;
-    MILP = _MILP;
-    tFactor = _tFactor;
-
-    glp_init_smcp(&parm);
-    parm.msg_lev = GLP_MSG_ERR;
-}
-
 /**
- * compute the width and left of the blocks
- * @param arr the array of start/end times of the blocks. It will be freed before this function returns.
+ * compute the width and left of the blocks, using the state of the current thread
+ * @param arr the array of start/end times of the blocks
  * @param N the number of blocks
+ * @returns the blocks, or NULL on allocation failure
  */
-ScheduleBlock* compute(const TimeEntry<int16_t>* arr, int _N) {
+ScheduleBlock* computeBlocks(const TimeEntry<int16_t>* arr, int _N) {
+    STATS_TIMER(renderNs);
+    Tracer::Span span{Tracer::Phase::render, _N};
 #ifdef DEBUG_LOG
     auto t1 = chrono::high_resolution_clock::now();
 #endif
@@ -744,6 +760,7 @@ ScheduleBlock* compute(const TimeEntry<int16_t>* arr, int _N) {
         newMem = realloc(idxMap, N * sizeof(int));
         if (!newMem) return NULL;
         idxMap = static_cast<int*>(newMem);
+        Memory::track(MEMORY_RENDER_BLOCKS, (N - maxN) * (sizeof(ScheduleBlock) + 2 * sizeof(ScheduleBlock*) + sizeof(int)));
         maxN = N;
     }
     r_sumSq = r_sum = 0.0;
@@ -766,8 +783,6 @@ ScheduleBlock* compute(const TimeEntry<int16_t>* arr, int _N) {
         block.cleftN.resize(0);
         block.crightN.resize(0);
     }
-    // free the input memory
-    free((void*)arr);
     // ---------------------------- end setup --------------------------------------
 
 #ifdef EXTRA_MODELS
@@ -807,6 +822,7 @@ ScheduleBlock* compute(const TimeEntry<int16_t>* arr, int _N) {
     t1 = chrono::high_resolution_clock::now();
 #endif
     // STEP 5
+    Tracer::Span step5{Tracer::Phase::lpIterations, N};
     for (auto* block = blocks; block < end; block++) {
         if (block->visited) continue;
         double right = block->left + block->width;
@@ -860,6 +876,87 @@ ScheduleBlock* compute(const TimeEntry<int16_t>* arr, int _N) {
     return blocks;
 }
 
+// disable name-mangling for exported functions
+extern "C" {
+
+void setOptions(int _isTolerance, int _ISMethod, int _applyDFS,
+                int _dfsTolerance, int _LPIters, int _LPModel, int _MILP, double _tFactor) {
+    if (Capture::Record rec{Capture::Call::setOptions})
+        rec << _isTolerance << _ISMethod << _applyDFS << _dfsTolerance << _LPIters << _LPModel << _MILP << _tFactor;
+    isTolerance = _isTolerance;
+    ISMethod = _ISMethod;
+    applyDFS = _applyDFS;
+    dfsTolerance = _dfsTolerance;
+    LPIters = _LPIters;
+    LPModel = _LPModel;
+    MILP = _MILP;
+    tFactor = _tFactor;
+
+    glp_init_smcp(&parm);
+    parm.msg_lev = GLP_MSG_ERR;
+}
+
+/**
+ * compute the width and left of the blocks
+ * @param arr the array of start/end times of the blocks. It will be freed before this function returns.
+ * @param N the number of blocks
+ */
+ScheduleBlock* compute(const TimeEntry<int16_t>* arr, int _N) {
+    if (Capture::Record rec{Capture::Call::compute}) rec << Capture::bytes(arr, _N) << _N;
+    auto* result = computeBlocks(arr, _N);
+    // free the input memory
+    free((void*)arr);
+    return result;
+}
+
+/**
+ * compute the blocks of several days at once. The days are independent, so they are distributed to the threads of the pool
+ * @param arr the start/end times of the blocks of all days, concatenated. It will be freed before this function returns.
+ * @param dayLens the number of blocks of each day. It will be freed before this function returns.
+ * @param numDays the length of dayLens
+ * @returns the left, width and isFixed of each block in the order of arr, followed by the sum and the sum of squares of the widths of each day.
+ * It is valid until the next call. Returns NULL on allocation failure
+ */
+double* computeDays(const TimeEntry<int16_t>* arr, const int* dayLens, int numDays) {
+    static vector<double> results;
+    vector<int> dayOffsets(numDays + 1);
+    for (int i = 0; i < numDays; i++) dayOffsets[i + 1] = dayOffsets[i] + dayLens[i];
+    const int total = dayOffsets[numDays];
+    if (Capture::Record rec{Capture::Call::computeDays})
+        rec << Capture::bytes(arr, total) << Capture::bytes(dayLens, numDays) << numDays;
+    results.resize(total * 3 + numDays * 2);
+
+    vector<char> failed(numDays);
+    ThreadPool::parallelFor(numDays, 1, [&](int, int begin, int end) {
+        for (int day = begin; day < end; day++) {
+            const int len = dayLens[day], offset = dayOffsets[day];
+            double* dayResult = results.data() + offset * 3;
+            double* daySums = results.data() + total * 3 + day * 2;
+            daySums[0] = daySums[1] = 0.0;
+            if (len == 0) continue;
+
+            auto* dayBlocks = computeBlocks(arr + offset, len);
+            if (!dayBlocks) {
+                failed[day] = true;
+                continue;
+            }
+            for (int i = 0; i < len; i++) {
+                dayResult[i * 3] = dayBlocks[i].left;
+                dayResult[i * 3 + 1] = dayBlocks[i].width;
+                dayResult[i * 3 + 2] = dayBlocks[i].isFixed;
+            }
+            daySums[0] = r_sum;
+            daySums[1] = r_sumSq;
+        }
+    });
+    free((void*)arr);
+    free((void*)dayLens);
+    for (char f : failed) {
+        if (f) return NULL;
+    }
+    return results.data();
+}
+
 double getSum() { return r_sum; }
 double getSumSq() { return r_sumSq; }
 }
@@ -8,6 +8,7 @@
  *
  */
 import { ScheduleDays } from '@/models/Schedule';
+import { applyMemoryBudget } from '@/utils/other';
 
 export const options = {
     isTolerance: 0,
@@ -21,11 +22,43 @@ export const options = {
     tFactor: 0.1
 };
 
+let rendererModule: Promise<EMModule> | undefined;
+
+/**
+ * load the renderer module (wasm_renderer*.js) if it is not loaded yet. It links GLPK, so it is much larger than the core module,
+ * and it is not loaded with the page so that searches and generation do not wait for it
+ */
+export function loadRenderer() {
+    if (window.RendererModule) return Promise.resolve(window.RendererModule);
+    if (!rendererModule) {
+        rendererModule = new Promise<EMModule>((resolve, reject) => {
+            const script = document.createElement('script');
+            script.src = `js/wasm_renderer${window.wasmVariant}.js`;
+            script.onload = () => window.GetRenderer!().then(resolve, reject);
+            script.onerror = () => reject(new Error('Failed to load the renderer'));
+            document.head.appendChild(script);
+        }).then(
+            Module => {
+                window.RendererModule = Module;
+                // the renderer takes its share of the memory budget from the core module
+                applyMemoryBudget();
+                return Module;
+            },
+            err => {
+                // try again on the next call
+                rendererModule = undefined;
+                throw err;
+            }
+        );
+    }
+    return rendererModule;
+}
+
 /**
  * compute the width and left of the blocks contained in each day
  */
 export async function computeBlockPositions(days: ScheduleDays) {
-    const Module = window.NativeModule;
+    const Module = await loadRenderer();
 
     console.time('native compute');
     Module._setOptions(
@@ -38,52 +71,54 @@ export async function computeBlockPositions(days: ScheduleDays) {
         +options.MILP,
         options.tFactor
     );
+    let total = 0;
+    for (const blocks of days) total += blocks.length;
+    if (total === 0) {
+        console.timeEnd('native compute');
+        return;
+    }
+
+    // all days are computed at once, so that the native code can compute them in parallel
+    const bufPtr = Module._malloc(total * 4);
+    const lensPtr = Module._malloc(days.length * 4);
+    const u16 = new Int16Array(Module.HEAPU8.buffer, bufPtr, total * 2);
+    const lens = new Int32Array(Module.HEAPU8.buffer, lensPtr, days.length);
+    let offset = 0;
+    for (let d = 0; d < days.length; d++) {
+        const blocks = days[d];
+        lens[d] = blocks.length;
+        for (let i = 0; i < blocks.length; i++, offset++) {
+            u16[2 * offset] = blocks[i].startMin;
+            u16[2 * offset + 1] = blocks[i].endMin;
+        }
+    }
+    /**
+     * the rPtr returned by _computeDays is an pointer pointing to an array of doubles:
+     * (left, width, isFixed) of each block, in the order of the days, followed by (sum, sumSq) of the widths of each day
+     */
+    const rPtr = Module._computeDays(bufPtr, lensPtr, days.length);
+    if (rPtr === 0) {
+        alert('Out of memory!');
+        console.error('Out of memory!');
+        return;
+    }
+    const result = new Float64Array(Module.HEAPU8.buffer, rPtr, total * 3 + days.length * 2);
     let N = 0;
     let sum = 0;
     let sumSq = 0;
-    for (const blocks of days) {
+    offset = 0;
+    for (let d = 0; d < days.length; d++) {
+        const blocks = days[d];
         const len = blocks.length;
-        if (len === 0) continue;
-
-        const bufPtr = Module._malloc(len * 4);
-        const u16 = new Int16Array(Module.HEAPU8.buffer, bufPtr, len * 2);
-        for (let i = 0; i < len; i++) {
-            u16[2 * i] = blocks[i].startMin;
-            u16[2 * i + 1] = blocks[i].endMin;
-        }
-        /**
-         * the rPtr returned by _compute is an pointer pointing to an array of ScheduleBlock. The offsets of some important fields are listed below.
-         * ```cpp
-         * ScheduleBlock* rPtr = compute(bufPtr, len);
-         * assert(offsetof(ScheduleBlock, isFixed) == 0);
-         * assert(offsetof(ScheduleBlock, left) == 24);
-         * assert(offsetof(ScheduleBlock, width) == 32);
-         * assert(sizeof(ScheduleBlock) == 64);
-         * ```
-         */
-        const rPtr = Module._compute(bufPtr, len);
-        if (rPtr === 0) {
-            alert('Out of memory!');
-            console.error('Out of memory!');
-        }
-        const result = new Float64Array(Module.HEAPU8.buffer, rPtr, len * 8);
-        for (let i = 0; i < len; i++) {
-            blocks[i].left = result[8 * i + 3];
-            blocks[i].width = result[8 * i + 4];
+        for (let i = 0; i < len; i++, offset++) {
+            blocks[i].left = result[3 * offset];
+            blocks[i].width = result[3 * offset + 1];
+            if (options.showFixed && result[3 * offset + 2]) (blocks[i] as any).background = '#000';
         }
         if (len > N) {
             N = len;
-            sum = Module._getSum();
-            sumSq = Module._getSumSq();
-        }
-        // N += len;
-        // sum += Module._getSum();
-        // sumSq += Module._getSumSq();
-        if (options.showFixed) {
-            const arr = new Uint8Array(Module.HEAPU8.buffer, rPtr, len * 64);
-            for (let i = 0; i < len; i++) {
-                if (arr[64 * i]) (blocks[i] as any).background = '#000';
-            }
+            sum = result[3 * total + 2 * d];
+            sumSq = result[3 * total + 2 * d + 1];
         }
     }
     if (N > 0) console.log('mean', sum / N, 'variance', sumSq / N - (sum / N) ** 2);
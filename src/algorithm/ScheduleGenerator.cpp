@@ -17,6 +17,13 @@
 #include <random>
 #include <vector>
 
+#include "Capture.h"
+#include "Memory.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+#include "simd.h"
+
 using namespace std;
 
 namespace ScheduleGenerator {
@@ -27,6 +34,11 @@ inline T calcOverlap(T a, T b, T c, T d) {
     return min(b, d) - max(a, c);
 }
 
+/** the loops over schedules are only split across threads if each thread gets at least this many schedules */
+constexpr int MIN_PARALLEL_SCHEDULES = 4096;
+/** only the best this many schedules are fully sorted, see sortIndices */
+constexpr int MAX_SORTED = 1000;
+
 enum SortMode {
     fallback = 0,
     combined = 1
@@ -48,6 +60,8 @@ int sortMode = SortMode::combined;
 struct CoeffCache {
     float max, min;
     float* __restrict__ coeffs = NULL;
+    /** the length of coeffs */
+    int size = 0;
 };
 
 /** 
@@ -203,7 +217,12 @@ float distance(int idx) {
 float similarity(int idx) {
     int sum = numCourses;
     const auto* curSchedule = schedules + idx * numCourses;
-    for (int j = 0; j < numCourses; j++)
+    int j = 0;
+#ifdef USE_SIMD
+    for (; j + 8 <= numCourses; j += 8)
+        sum -= simd::countEq16(refSchedule + j, curSchedule + j);
+#endif
+    for (; j < numCourses; j++)
         sum -= (refSchedule[j] == curSchedule[j]);
     return sum;
 }
@@ -242,6 +261,20 @@ SortOption sortOptions[NUM_SORT_FUNCS];
  */
 CoeffCache sortCoeffCache[NUM_SORT_FUNCS];
 
+void freeCoeffCache(CoeffCache& cache) {
+    if (cache.coeffs == NULL) return;
+    delete[] cache.coeffs;
+    cache.coeffs = NULL;
+    Memory::track(MEMORY_SORT_COEFFS, -static_cast<int64_t>(cache.size * sizeof(float)));
+}
+
+bool isEnabled(int funcIdx) {
+    for (auto& option : sortOptions) {
+        if (option.enabled && option.idx == funcIdx) return true;
+    }
+    return false;
+}
+
 /**
  * whether the random sort option is enabled
  */
@@ -252,6 +285,65 @@ bool isRandom() {
     return false;
 }
 
+/**
+ * find the minimum and maximum of arr[0] to arr[n-1]
+ */
+void findRange(const float* __restrict__ arr, int n, float& min, float& max) {
+    max = -std::numeric_limits<float>::infinity();
+    min = std::numeric_limits<float>::infinity();
+    int i = 0;
+#ifdef USE_SIMD
+    if (n >= 4) {
+        auto vMax = simd::load(arr), vMin = vMax;
+        for (i = 4; i + 4 <= n; i += 4) {
+            auto val = simd::load(arr + i);
+            vMax = simd::max(vMax, val);
+            vMin = simd::min(vMin, val);
+        }
+        float maxLanes[4], minLanes[4];
+        simd::store(maxLanes, vMax);
+        simd::store(minLanes, vMin);
+        for (int j = 0; j < 4; j++) {
+            if (maxLanes[j] > max) max = maxLanes[j];
+            if (minLanes[j] < min) min = minLanes[j];
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        float val = arr[i];
+        if (val > max) max = val;
+        if (val < min) min = val;
+    }
+}
+
+/**
+ * add weight * val * val to coeffs[i] for each schedule i, where val is coeff[i] normalized to [0, 1]:
+ * (coeff[i] - min) * normalizeRatio, or (max - coeff[i]) * normalizeRatio if reverse
+ */
+void addNormalizedSquares(const float* __restrict__ coeff, float min, float max, float normalizeRatio, float weight, bool reverse) {
+    int i = 0;
+#ifdef USE_SIMD
+    const auto vMin = simd::splat(min), vMax = simd::splat(max), vRatio = simd::splat(normalizeRatio),
+               vWeight = simd::splat(weight);
+    for (; i + 4 <= count; i += 4) {
+        auto c = simd::load(coeff + i);
+        auto val = simd::mul(reverse ? simd::sub(vMax, c) : simd::sub(c, vMin), vRatio);
+        simd::store(coeffs + i, simd::add(simd::load(coeffs + i), simd::mul(simd::mul(vWeight, val), val)));
+    }
+#endif
+    if (reverse) {
+        for (; i < count; i++) {
+            float val = (max - coeff[i]) * normalizeRatio;
+            coeffs[i] += weight * val * val;
+        }
+    } else {
+        for (; i < count; i++) {
+            float val = (coeff[i] - min) * normalizeRatio;
+            coeffs[i] += weight * val * val;
+        }
+    }
+}
+
 /**
  * compute the coefficient array for a specific sorting option.
  * if it exists (i.e. already computed), don't do anything
@@ -265,17 +357,27 @@ CoeffCache computeCoeffFor(int funcIdx, bool assign) {
         if (assign) memcpy(coeffs, cache.coeffs, count * sizeof(float));
         return cache;
     } else {
+        STATS_TIMER(coeffNs);
+        Tracer::Span span{Tracer::Phase::computeCoeff, funcIdx};
+        STATS_ADD(metricEvals, count);
+        // if they do not fit in the memory budget, make room by evicting the coefficients of the sort functions that are not enabled
+        if (!Memory::fits(count * sizeof(float))) {
+            for (int i = 0; i < NUM_SORT_FUNCS; i++) {
+                if (i == funcIdx || sortCoeffCache[i].coeffs == NULL || isEnabled(i)) continue;
+                freeCoeffCache(sortCoeffCache[i]);
+                Memory::degrade(MEMORY_EVICTED_COEFFS);
+            }
+        }
         auto* __restrict__ newCache = new float[count];
-        float max = -std::numeric_limits<float>::infinity(),
-              min = std::numeric_limits<float>::infinity();
+        Memory::track(MEMORY_SORT_COEFFS, count * sizeof(float));
         auto evalFunc = sortFunctions[funcIdx];
-        for (int i = 0; i < count; i++) {
-            float val = (newCache[i] = evalFunc(i));
-            if (val > max) max = val;
-            if (val < min) min = val;
-        }
+        ThreadPool::parallelFor(count, MIN_PARALLEL_SCHEDULES, [=](int, int begin, int end) {
+            for (int i = begin; i < end; i++) newCache[i] = evalFunc(i);
+        });
+        float max, min;
+        findRange(newCache, count, min, max);
         if (assign) memcpy(coeffs, newCache, count * sizeof(float));
-        return (sortCoeffCache[funcIdx] = {max, min, newCache});
+        return (sortCoeffCache[funcIdx] = {max, min, newCache, count});
     }
 }
 
@@ -310,74 +412,115 @@ void computeCoeff(int enabled, int lastIdx) {
                 continue;
             }
 
-            float normalizeRatio = 1 / range,
-                  weight = option.weight;
-            auto coeff = cache.coeffs;
             // use Euclidean distance to combine multiple sorting coefficients
-            if (option.reverse) {
-                for (int i = 0; i < count; i++) {
-                    float val = (max - coeff[i]) * normalizeRatio;
-                    coeffs[i] += weight * val * val;
-                }
-            } else {
-                for (int i = 0; i < count; i++) {
-                    float val = (coeff[i] - min) * normalizeRatio;
-                    coeffs[i] += weight * val * val;
-                }
-            }
+            addNormalizedSquares(cache.coeffs, min, max, 1 / range, option.weight, option.reverse);
         }
     }
 }
 
+/**
+ * sort the indices of the schedules by cmp. Only the best MAX_SORTED schedules are sorted, followed by the rest in their original order.
+ * With threads, each thread selects the best schedules of its chunk, and the best of those are sorted.
+ * Ties are broken by the index of the schedule, so that the result does not depend on the number of threads
+ */
+template <typename F>
+void sortIndices(F cmp) {
+    STATS_TIMER(sortNs);
+    Tracer::Span span{Tracer::Phase::sort, count};
+    const int numSorted = min(count, MAX_SORTED);
+    auto cmpTie = [cmp](int a, int b) { return cmp(a, b) || (!cmp(b, a) && a < b); };
+    vector<int> best;
+#ifdef USE_THREADS
+    const int numWorkers = min(ThreadPool::size(), count / MIN_PARALLEL_SCHEDULES);
+    if (numWorkers > 1) {
+        vector<int> chunkBest[ThreadPool::MAX_THREADS];
+        ThreadPool::parallelFor(count, MIN_PARALLEL_SCHEDULES, [&](int worker, int begin, int end) {
+            const int k = min(numSorted, end - begin);
+            partial_sort(indices + begin, indices + begin + k, indices + end, cmpTie);
+            chunkBest[worker].assign(indices + begin, indices + begin + k);
+        });
+        for (const auto& b : chunkBest) best.insert(best.end(), b.begin(), b.end());
+        partial_sort(best.begin(), best.begin() + numSorted, best.end(), cmpTie);
+    }
+#endif
+    if (best.empty()) {
+        if (count <= MAX_SORTED) {
+            std::sort(indices, indices + count, cmpTie);
+            return;
+        }
+        std::partial_sort(indices, indices + numSorted, indices + count, cmpTie);
+        best.assign(indices, indices + numSorted);
+    }
+    // the best schedules, followed by all other schedules in the original order
+    vector<bool> isSorted(count);
+    for (int i = 0; i < numSorted; i++) isSorted[indices[i] = best[i]] = true;
+    for (int i = 0, j = numSorted; i < count; i++) {
+        if (!isSorted[i]) indices[j++] = i;
+    }
+}
+
 extern "C" {
 
 /**
  * initialize the global indices, offsets and blocks array so the sort function can use then
 */
 void addToEval(const uint16_t* __restrict__ timeArray, const int* __restrict__ sectionLens) {
+    STATS_TIMER(addToEvalNs);
+    Tracer::Span span{Tracer::Phase::addToEval, count};
+    // the blocks of each schedule have 8 day offsets, followed by the time blocks of all of its sections,
+    // so their offsets can be computed before the schedules are filled in parallel
     int offset = 0;
+    for (int i = 0; i < count; i++) {
+        const auto* curSchedule = schedules + i * numCourses;
+        offsets[i] = offset;
+        offset += 8;
+        for (int k = 0; k < numCourses; k++) {
+            int _off = curSchedule[k] * 8;
+            offset += timeArray[_off + 7] - timeArray[_off];
+        }
+    }
     // point to the second part of the timeArray where the content is stored
     // should not alias with timeArray, which should be only used to access the first part
     const auto* __restrict__ timeArrayContent = timeArray + (sectionLens[numCourses]) * 8;
-    const auto* __restrict__ curSchedule = schedules;
-    // store the time and room information corresponding to curSchedule
-    auto* __restrict__ curBlock = blocks;
-    for (int i = 0; i < count; i++) {  // for each schedule
-        int bound = 8;
-        for (int j = 0; j < 7; j++) {  // sort the time blocks in order for each day
-            // start index of day j in curBlock
-            int s1 = (curBlock[j] = bound);
-
-            // for each section selected (for each course), extract its time blocks on day j,
-            // and insert into day j of curBlock
-            for (int k = 0; k < numCourses; k++) {
-                // offset of the time arrays
-                int _off = curSchedule[k] * 8 + j;
-                // insertion sort, fast for small arrays
-                for (int n = timeArray[_off], e2 = timeArray[_off + 1]; n < e2; n += 3, bound += 3) {
-                    int p = s1;
-                    uint16_t vToBeInserted = timeArrayContent[n];
-                    for (; p < bound; p += 3) {
-                        if (vToBeInserted < curBlock[p]) break;
+    ThreadPool::parallelFor(count, MIN_PARALLEL_SCHEDULES, [=](int, int begin, int end) {
+        STATS_ONLY(uint64_t moves = 0);
+        for (int i = begin; i < end; i++) {  // for each schedule
+            const auto* __restrict__ curSchedule = schedules + i * numCourses;
+            // store the time and room information corresponding to curSchedule
+            auto* __restrict__ curBlock = blocks + offsets[i];
+            int bound = 8;
+            for (int j = 0; j < 7; j++) {  // sort the time blocks in order for each day
+                // start index of day j in curBlock
+                int s1 = (curBlock[j] = bound);
+
+                // for each section selected (for each course), extract its time blocks on day j,
+                // and insert into day j of curBlock
+                for (int k = 0; k < numCourses; k++) {
+                    // offset of the time arrays
+                    int _off = curSchedule[k] * 8 + j;
+                    // insertion sort, fast for small arrays
+                    for (int n = timeArray[_off], e2 = timeArray[_off + 1]; n < e2; n += 3, bound += 3) {
+                        int p = s1;
+                        uint16_t vToBeInserted = timeArrayContent[n];
+                        for (; p < bound; p += 3) {
+                            if (vToBeInserted < curBlock[p]) break;
+                        }
+                        // move elements 3 slots toward the end
+                        for (int m = bound - 1; m >= p; m--) curBlock[m + 3] = curBlock[m];
+                        STATS_ONLY(moves += bound - p + 3);
+                        // insert three elements at p
+                        curBlock[p] = timeArrayContent[n];
+                        curBlock[p + 1] = timeArrayContent[n + 1];
+                        curBlock[p + 2] = timeArrayContent[n + 2];
+                        // TODO: bulk move
+                        // *((TimeEntry*)&timeArrayContent[n]) = *((TimeEntry*)&curBlock[p]);
                     }
-                    // move elements 3 slots toward the end
-                    for (int m = bound - 1; m >= p; m--) curBlock[m + 3] = curBlock[m];
-                    // insert three elements at p
-                    curBlock[p] = timeArrayContent[n];
-                    curBlock[p + 1] = timeArrayContent[n + 1];
-                    curBlock[p + 2] = timeArrayContent[n + 2];
-                    // TODO: bulk move
-                    // *((TimeEntry*)&timeArrayContent[n]) = *((TimeEntry*)&curBlock[p]);
                 }
             }
+            curBlock[7] = bound;
         }
-        // record the current offset
-        offsets[i] = offset;
-        offset += curBlock[7] = bound;
-        // goto the next schedule
-        curBlock += bound;
-        curSchedule += numCourses;
-    }
+        STATS_ADD(evalMoves, moves);
+    });
 }
 /**
  * @param _numCourses number of courses
@@ -392,15 +535,38 @@ void addToEval(const uint16_t* __restrict__ timeArray, const int* __restrict__ s
  * @returns the number of schedules generated. Returns -1 on memory allocation failure
  */
 int generate(const int _numCourses, int maxNumSchedules, const int* __restrict__ sectionLens, const uint8_t* __restrict__ conflictCache, const uint16_t* __restrict__ timeArray) {
+    if (Capture::Record rec{Capture::Call::generate}) {
+        const int numSections = sectionLens[_numCourses];
+        // the last offset of timeArray is the length of its content
+        const int timeArrayLen = numSections == 0 ? 0 : numSections * 8 + timeArray[numSections * 8 - 1];
+        rec << _numCourses << maxNumSchedules << Capture::bytes(sectionLens, _numCourses + 1)
+            << Capture::bytes(conflictCache, numSections * numSections) << Capture::bytes(timeArray, timeArrayLen);
+    }
+    STATS_TIMER(generateNs);
+    Tracer::Span span{Tracer::Phase::generate, _numCourses};
+    STATS_ONLY(uint64_t nodes = 0, conflictChecks = 0, backtracks = 0);
     numCourses = _numCourses;
     maxNumSchedules *= numCourses;
+    bool limited = false;
+    if (maxNumSchedules + numCourses > scheduleLen) {
+        // keep fewer schedules if they do not fit in the memory budget. They may use a quarter of what is left,
+        // the rest is for their blocks in evalMem, which are several times larger
+        const int64_t affordableLen = scheduleLen + max<int64_t>(Memory::available() / 8, 0);
+        if (maxNumSchedules + numCourses > affordableLen) {
+            maxNumSchedules = max<int64_t>(affordableLen - numCourses, 0) / numCourses * numCourses;
+            if (maxNumSchedules == 0) return -1;
+            limited = true;
+        }
+    }
     if (maxNumSchedules + numCourses > scheduleLen) {
         // extra 1x numCourses to prevent write out of bound at computeSchedules at *!*!*
-        scheduleLen = maxNumSchedules + numCourses;
-        auto* newMem = (uint16_t*)realloc(schedules, scheduleLen * 2);
+        const int newLen = maxNumSchedules + numCourses;
+        auto* newMem = (uint16_t*)realloc(schedules, newLen * 2);
         // handle allocation failure
         if (newMem == NULL) return -1;
+        Memory::track(MEMORY_SCHEDULES, (newLen - scheduleLen) * 2);
         schedules = newMem;
+        scheduleLen = newLen;
     }
 
     /** the total length of the time array that we need to allocate for schedules generated */
@@ -435,6 +601,7 @@ int generate(const int _numCourses, int maxNumSchedules, const int* __restrict__
         while (sectionIdx >= sectionLens[courseIdx + 1]) {
             // return to the previous class
             // if all possibilities are exhausted, break out the loop
+            STATS_ONLY(backtracks++);
             if (--courseIdx < 0) goto end;
 
             // explore the next possibility
@@ -445,6 +612,7 @@ int generate(const int _numCourses, int maxNumSchedules, const int* __restrict__
         // check conflict between the newly chosen section and the sections already in the schedule
         int temp = sectionIdx * numSections;
         for (int i = 0; i < courseIdx; i++) {
+            STATS_ONLY(conflictChecks++);
             if (conflictCache[temp + curSchedule[i]]) {
                 // if conflict, increment the section index
                 ++sectionIdx;
@@ -455,12 +623,17 @@ int generate(const int _numCourses, int maxNumSchedules, const int* __restrict__
         // if the section does not conflict with any previously chosen sections,
         // record the section and go to the next class,
         curSchedule[courseIdx++] = sectionIdx;
+        STATS_ONLY(nodes++);
         // set choice num to be the first section of the next class
         sectionIdx = sectionLens[courseIdx];
     }
 end:;
+    STATS_ADD(dfsNodes, nodes);
+    STATS_ADD(conflictChecks, conflictChecks);
+    STATS_ADD(backtracks, backtracks);
     count = (curSchedule - schedules) / numCourses;
     timeLen += 8 * count;
+    if (limited && count * numCourses >= maxNumSchedules) Memory::degrade(MEMORY_FEWER_SCHEDULES);
 
     /**
      * backing storage for indices, coeffs, offsets and blocks
@@ -473,16 +646,38 @@ end:;
 
     // handle reallocation of memory
     uint32_t newMemSize = (uint32_t)(count)*3 * 4 + (uint32_t)(timeLen)*2;
+    if (newMemSize > memSize && !Memory::fits(newMemSize - memSize)) {
+        // keep the first schedules whose blocks fit in the memory budget
+        const int64_t affordable = memSize + max<int64_t>(Memory::available(), 0);
+        int kept = 0;
+        int64_t keptTimeLen = 0;
+        for (; kept < count; kept++) {
+            const auto* schedule = schedules + kept * numCourses;
+            int64_t len = 8;
+            for (int i = 0; i < numCourses; i++) len += timeArray[schedule[i] * 8 + 7] - timeArray[schedule[i] * 8];
+            if ((kept + 1) * 3 * 4 + (keptTimeLen + len) * 2 > affordable) break;
+            keptTimeLen += len;
+        }
+        if (kept == 0) {
+            count = 0;
+            return -1;
+        }
+        count = kept;
+        newMemSize = count * 3 * 4 + keptTimeLen * 2;
+        Memory::degrade(MEMORY_FEWER_SCHEDULES);
+    }
     if (newMemSize > memSize) {
         void* newMem = realloc(evalMem, newMemSize);
         if (newMem == NULL) return -1;
+        Memory::track(MEMORY_EVAL, newMemSize - memSize);
         evalMem = newMem;
         memSize = newMemSize;
-        indices = (int*)evalMem;
-        coeffs = ((float*)evalMem) + count;
-        offsets = ((int*)evalMem) + 2 * count;
-        blocks = ((uint16_t*)evalMem) + 6 * count;
     }
+    // the arrays are laid out for the current count, even if the memory is not reallocated
+    indices = (int*)evalMem;
+    coeffs = ((float*)evalMem) + count;
+    offsets = ((int*)evalMem) + 2 * count;
+    blocks = ((uint16_t*)evalMem) + 6 * count;
 
     addToEval(timeArray, sectionLens);
 
@@ -492,12 +687,7 @@ end:;
     free((void*)conflictCache);
     free((void*)timeArray);
 #endif
-    for (auto& cache : sortCoeffCache) {
-        if (cache.coeffs != NULL) {
-            delete[] cache.coeffs;
-            cache.coeffs = NULL;
-        }
-    }
+    for (auto& cache : sortCoeffCache) freeCoeffCache(cache);
     return count;
 }
 
@@ -505,6 +695,8 @@ end:;
  * sort the array of schedules according to their quality coefficients which will be computed by `computeCoeff`
  */
 void sort() {
+    // no arguments: the record only holds the call id
+    Capture::Record rec{Capture::Call::sort};
     // we start from the original order
     // so that when the sort is performed repetitively, the result will be stable
     for (int i = 0; i < count; i++)
@@ -541,11 +733,7 @@ void sort() {
             enabledOptions[0].reverse && enabled == 1
                 ? [](int a, int b) { return coeffs[b] < coeffs[a]; }   // descending
                 : [](int a, int b) { return coeffs[a] < coeffs[b]; };  // ascending
-        if (count > 1000) {
-            std::partial_sort(indices, indices + 1000, indices + count, cmpFunc);
-        } else {
-            std::sort(indices, indices + count, cmpFunc);
-        }
+        sortIndices(cmpFunc);
     } else {
         struct {
             float rev;
@@ -570,23 +758,22 @@ void sort() {
             }
             return r < 0;
         };
-        if (count > 1000) {
-            std::partial_sort(indices, indices + 1000, indices + count, func);
-        } else {
-            std::sort(indices, indices + count, func);
-        }
+        sortIndices(func);
     }
 }
 
 void setSortMode(int mode) {
+    if (Capture::Record rec{Capture::Call::setSortMode}) rec << mode;
     sortMode = mode;
 }
 
 void setSortOption(int i, int enabled, int reverse, int idx, float weight) {
+    if (Capture::Record rec{Capture::Call::setSortOption}) rec << i << enabled << reverse << idx << weight;
     sortOptions[i] = {(bool)enabled, (bool)reverse, idx, weight};
 }
 
 void setTimeMatrix(int* ptr, int sideLen) {
+    if (Capture::Record rec{Capture::Call::setTimeMatrix}) rec << Capture::bytes(ptr, sideLen * sideLen) << sideLen;
     if (timeMatrix != NULL) delete[] timeMatrix;
     timeMatrix = ptr;
     tmSize = sideLen;
@@ -605,13 +792,10 @@ float getRange(int idx) {
 }
 
 void setRefSchedule(uint16_t* ref) {
+    if (Capture::Record rec{Capture::Call::setRefSchedule}) rec << Capture::bytes(ref, numCourses);
     if (refSchedule != NULL) free(refSchedule);
     refSchedule = ref;
-    auto& cache = sortCoeffCache[5];
-    if (cache.coeffs != NULL) {
-        delete[] cache.coeffs;
-        cache.coeffs = NULL;
-    }
+    freeCoeffCache(sortCoeffCache[5]);
 }
 }
 
@@ -1,9 +1,18 @@
 #include <algorithm>
+#include <array>
 #include <cstring>
 #include <iostream>
+#include <list>
 #include <string_view>
 #include <vector>
 
+#include "Capture.h"
+#include "Memory.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+#include "simd.h"
+
 #ifdef USE_FLATMAP
 
 #include "parallel-hashmap/parallel_hashmap/phmap.h"
@@ -20,60 +29,388 @@ using HashMap = std::unordered_map<K, V>;
 
 using namespace std;
 using GramMap = HashMap<string_view, int16_t*>;
+/**
+ * a gram of length <= MAX_INT_GRAM_LEN packed into an integer, one byte per character
+ */
+using Gram = uint32_t;
 
 namespace Searcher {
 
+constexpr int MAX_INT_GRAM_LEN = sizeof(Gram);
+/** tokens and query words shorter than this are never matched by edit distance */
+constexpr int MIN_TYPO_LEN = 3;
+/** the index is not compacted until there are at least this many postings added after it was built */
+constexpr int MIN_COMPACTION_POSTINGS = 4096;
+/** a loop is only split across threads if each thread gets at least this many iterations */
+constexpr int MIN_PARALLEL_WORK = 2048;
+/** the result cache of a searcher holds at most this many queries, and at most MAX_CACHE_BYTES bytes of results */
+constexpr int MAX_CACHED_RESULTS = 64;
+constexpr size_t MAX_CACHE_BYTES = 1 << 20;
+/** fraction of the smaller score of two adjacent tokens that is added to the window when they match consecutive query words */
+constexpr float PHRASE_BONUS = 0.5f;
+/** "FSIX" in little endian */
+constexpr uint32_t IMAGE_MAGIC = 0x58495346;
+/** increment this whenever the layout of the index or of the image changes */
+constexpr uint32_t IMAGE_VERSION = 2;
+
 struct Match {
     int start, end;
 };
 
-struct Token {
-    string_view token;
-    float score;
-    vector<Match> matches;
+/**
+ * a unique token, stored as a span of the text buffer (its first occurrence)
+ */
+struct TokenEntry {
+    int offset;
+    int length;
 };
 
-// an indexed token contains an index/pointer to the array of unique tokens
-// and also an index of this token in the original sentence that contains it
-struct IndexedToken {
-    union {
-        int idx;
-        Token* token;
-    };
-    int index;
+/**
+ * a sentence, stored as a span of the text buffer and a span of the token arrays
+ */
+struct SentenceEntry {
+    int textOffset;
+    int textLength;
+    int tokenOffset;
+    int tokenCount;
 };
 
-struct Sentence {
-    // view of _original
-    string_view original;
-    // the sentence in its original form
-    const char* _original;
-    // tokenized sentence
-    vector<IndexedToken> tokens;
-    // score for this sentence (computed after a search)
-    float score;
-    // matches for this sentence (computed after a search)
-    vector<Match> matches;
-    ~Sentence() {
-        free((void*)_original);
-    }
+/**
+ * an entry in the posting list of a gram: a unique token containing the gram, and the number of times it occurs in the token
+ */
+struct Posting {
+    int token;
+    int count;
+};
+
+/**
+ * the posting lists of the grams of all unique tokens, for a specific gram length, stored in CSR format.
+ * postings[offsets[i]] to postings[offsets[i + 1]] are the tokens that contain grams[i]
+ * @note all three arrays are stored in a single block of memory
+ */
+struct GramIndex {
+    int gramLen = 0;
+    // number of distinct grams
+    int size = 0;
+    // sorted
+    Gram* grams = NULL;
+    int* offsets = NULL;
+    Posting* postings = NULL;
+    // the block of memory owned by this index. NULL if the arrays are in a loaded image
+    void* mem = NULL;
+    // the number of unique tokens when the index was built
+    int numTokens = 0;
+    // postings of the tokens added after the index was built, appended as the tokens are added
+    HashMap<Gram, vector<Posting>> extra;
+    // total number of postings in extra
+    int numExtra = 0;
+};
+
+/**
+ * deletion-neighborhood (SymSpell) index of the unique tokens, used to find the tokens within a small edit distance of a query word.
+ * Every string obtained by deleting at most maxDistance characters from a token is hashed,
+ * and the tokens are stored by hash in CSR format: tokens[offsets[i]] to tokens[offsets[i + 1]] have a deletion whose hash is hashes[i].
+ * Two strings are within edit distance d only if they have a common deletion of at most d characters, so a lookup only needs
+ * the deletions of the query word. Hash collisions are filtered out by computing the actual edit distance
+ */
+struct TypoIndex {
+    // 0 if typo tolerance is disabled
+    int maxDistance = 0;
+    // weight of the score of a token matched by edit distance, relative to the score of an exact match
+    float weight = 0.0f;
+    // the max distance the index was built for
+    int builtDistance = 0;
+    // the number of unique tokens when the index was built. Tokens added afterwards are compared with the query words one by one
+    int numTokens = 0;
+    int size = 0;
+    // sorted
+    uint32_t* hashes = NULL;
+    int* offsets = NULL;
+    int* tokens = NULL;
+    void* mem = NULL;
+};
+
+/**
+ * suffix array of the text buffer, with the length of the longest common prefix (LCP) of each suffix and the previous one in sorted order.
+ * Every sentence is terminated by a NULL character, so a match never spans two sentences
+ */
+struct SuffixIndex {
+    // length of the text
+    int size = 0;
+    // start positions of the suffixes, in lexicographical order
+    int* suffixes = NULL;
+    // lcp[i] is the LCP of suffixes[i - 1] and suffixes[i]. lcp[0] = 0
+    int* lcp = NULL;
+    // NULL if the index is not built
+    void* mem = NULL;
+};
+
+/**
+ * the state left by the last query, kept so that the next query can reuse its work if it extends the last query
+ */
+struct QueryState {
+    // the last query. Empty if the state cannot be reused
+    string query;
+    int gramLen = 0;
+    // frequency of each gram in the query
+    HashMap<Gram, int> gramFreq;
+    // the number of grams that each unique token has in common with the query
+    vector<int> intersections;
+    // score of each unique token
+    vector<float> tokenScores;
+    // score of each sentence
+    vector<float> sentenceScores;
+    // unique tokens with a nonzero intersection
+    vector<int> matchedTokens;
+    // index of the query word that each token matches, i.e. the word of the first query gram that the token contains.
+    // -1 if the token is not matched
+    vector<int> tokenWords;
+    // tokens whose score in the last query comes from their edit distance to a query word
+    vector<int> typoTokens;
+    vector<uint8_t> isTypoToken;
+    // sentences that may have a nonzero score, i.e. sentences that contain at least one matched token.
+    // Appending grams to the query can only increase intersections, so this set only grows until the state is reset
+    vector<int> candidates;
+    vector<uint8_t> isCandidate;
+    // weighted sum of the scores of the fields of each document. Only used if there is more than one field
+    vector<float> docScores;
+    // documents with at least one candidate field
+    vector<int> docCandidates;
+    vector<uint8_t> isDocCandidate;
+    // the generation of the dictionary state that the matched tokens were copied from,
+    // and the number of matched tokens of the dictionary that were copied
+    int dictGeneration = -1;
+    int dictMatched = 0;
+};
+
+/**
+ * buffers holding the matches of the last query. Matches are only computed for tokens that appear in the returned results
+ */
+struct MatchState {
+    // the id of the query for which the matches of each unique token were computed
+    vector<int> tokenQuery;
+    // span of each unique token's matches in tokenMatches
+    vector<int> tokenMatchOffsets;
+    vector<int> tokenMatchSizes;
+    vector<Match> tokenMatches;
+    // matches of field f of the i-th result are resultMatches[resultOffsets[k]] to resultMatches[resultOffsets[k + 1]], k = i * numFields + f
+    vector<int> resultOffsets;
+    vector<Match> resultMatches;
+    // all results packed in a single buffer, see getResultsPacked
+    vector<int32_t> packedResults;
+};
+
+/**
+ * all the scratch memory of a query. Queries only read the index, so two searchers never share anything that a query writes
+ */
+struct QueryContext {
+    // the words of the current query
+    vector<string_view> words;
+    // working windows for computing results, maxTokenLen floats for each scoring thread
+    float* scoreWindow = nullptr;
+    int* indices = nullptr;
+    // number of results returned by the last query
+    int numResults = 0;
+    QueryState state;
+    MatchState matchState;
+    int queryId = 0;
+};
+
+/**
+ * the part of a QueryState that the next query reuses if it extends the query: the matched tokens and the candidates.
+ * The scores are not kept, because they are recomputed by every query
+ */
+struct SavedQueryState {
+    string query;
+    // 0 if the state is not kept, in which case the next query starts from scratch
+    int gramLen = 0;
+    vector<pair<Gram, int>> gramFreq;
+    // the intersection and the word of each matched token
+    vector<int> matchedTokens, intersections, tokenWords;
+    vector<int> candidates;
+    int dictGeneration = -1;
+    int dictMatched = 0;
+};
+
+/**
+ * the results of a query, as needed to restore them without running the query again
+ */
+struct CachedResult {
+    // the query and its parameters, see resultCacheKey
+    string key;
+    vector<int> indices;
+    // score of field f of the i-th result is fieldScores[i * numFields + f]
+    vector<float> fieldScores;
+    vector<int> resultOffsets;
+    vector<Match> resultMatches;
+    SavedQueryState state;
+};
+
+/**
+ * LRU cache of the results of the last queries. It is cleared whenever the index or the scoring parameters change
+ */
+struct ResultCache {
+    // most recently used first
+    list<CachedResult> entries;
+    // keys point to the keys of the entries
+    HashMap<string_view, list<CachedResult>::iterator> lookup;
+    // total size of the entries
+    size_t bytes = 0;
+};
+
+/**
+ * a token dictionary shared by several searchers whose vocabularies overlap, e.g. the searchers of several semesters.
+ * The gram indices are only built for the dictionary, and the tokens of a query are matched once by the dictionary,
+ * then mapped to the tokens of each searcher. The searchers of a group must not be queried concurrently.
+ * The dictionary is reference counted: it is freed once its creator and all searchers attached to it have released it
+ */
+struct Dictionary {
+    int refCount = 1;
+    // the tokens, each terminated by a NULL character
+    vector<char> text;
+    vector<TokenEntry> tokens;
+    HashMap<string, int> ids;
+    // gram indices for gram lengths 2 to MAX_INT_GRAM_LEN, built on first use
+    GramIndex gramIndices[MAX_INT_GRAM_LEN + 1];
+    // the tokens matched by the last query. Only query, gramLen, gramFreq, intersections, tokenWords and matchedTokens are used
+    QueryState state;
+    // incremented whenever the state is reset, so that searchers know when the matched tokens they copied are stale
+    int generation = 0;
+};
+
+/**
+ * the offsets of the arrays of the index in the arena, in bytes
+ * @note fixed width so that images are portable between wasm32 and native builds
+ */
+struct ArenaLayout {
+    uint32_t text, sentences, tokenIds, tokenPositions, uniqueTokens, tokenSentOffsets, tokenSentences, fieldWeights;
+    // total size of the arena
+    uint32_t size;
+};
+
+/**
+ * the layout of a gram index in an image
+ */
+struct GramIndexLayout {
+    // 0 if the index is not in the image
+    int32_t size;
+    uint32_t grams, offsets, postings;
+};
+
+/**
+ * header of a serialized index (an image). It is followed by the arena and the gram indices.
+ * All offsets are in bytes, relative to the start of the image. Only little-endian targets (wasm, x86, arm) are supported
+ */
+struct ImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    // size of the whole image
+    uint32_t size;
+    int32_t numSentences;
+    int32_t numFields;
+    int32_t numUnique;
+    int32_t maxTokenLen;
+    ArenaLayout layout;
+    GramIndexLayout gramIndices[MAX_INT_GRAM_LEN + 1];
+};
+
+/**
+ * growable copies of the arrays of the index, created when the index is modified for the first time (copy on write).
+ * Token ids are indices into uniqueTokens, so they stay valid when tokens are appended.
+ * Sentences are never modified in place: a modified sentence is appended, and its old text and tokens become garbage until compaction
+ */
+struct MutableIndex {
+    vector<char> text;
+    vector<SentenceEntry> sentences;
+    vector<int> tokenIds;
+    vector<int> tokenPositions;
+    vector<TokenEntry> uniqueTokens;
+    HashMap<string, int> str2num;
+    // the sentences that contain each token, added since the index was built, as linked lists of postings.
+    // postingHeads[i] is the first posting of token i, -1 if there is none
+    vector<int> postingHeads;
+    vector<pair<int, int>> postings;  // {sentence, next}
+    // number of bytes of the arrays above that are no longer referenced
+    int garbage = 0;
 };
 
 /**
  * represents an instance of FastSearcher
- * In theroy this can be written as a c++ class, 
+ * In theroy this can be written as a c++ class,
  * but embind has higher code size/runtime overhead, so plain C-struct is used instead
+ *
+ * The index is stored in flat arrays that live in a single block of memory (the arena) and only refer to each other by offsets.
+ * The arena is never modified after it is built. Once sentences are added, updated or removed,
+ * the arrays point to a MutableIndex instead, until the index is compacted into a new arena
+ *
+ * A document may have several fields, each of which is indexed as a sentence.
+ * The fields of document i are the sentences i * numFields to (i + 1) * numFields - 1, and they share the same unique tokens
 */
 struct FastSearcher {
+    // number of sentences
     int size;
-    // array of pre-processed and tokenized sentences
-    Sentence* sentences;
-    // working window for computing results
-    float* scoreWindow;
-    int* indices;
-    vector<Token> uniqueTokens;
+    // number of documents and of fields per document. size = numDocs * numFields
+    int numDocs;
+    int numFields;
+    // number of unique tokens
+    int numUnique;
+    // maximum number of tokens in a sentence
+    int maxTokenLen;
+    // the block of memory that backs all the arrays below. For a loaded searcher, this is the image
+    void* arena;
+    // the length of the text, including the NULL terminators
+    int textSize;
+    // the number of unique tokens whose sentences are in tokenSentOffsets/tokenSentences
+    int numPostedTokens;
+    // the modified index. NULL if the index has not been modified since it was built
+    MutableIndex* mut;
+    // offsets of the arrays below, relative to arena
+    ArenaLayout layout;
+
+    // all sentences concatenated, each terminated by a NULL character
+    const char* text;
+    const SentenceEntry* sentences;
+    // id (index into uniqueTokens) of each token of each sentence
+    const int* tokenIds;
+    // start index of each token of each sentence, relative to the start of the sentence
+    const int* tokenPositions;
+    const TokenEntry* uniqueTokens;
+    // the sentences that contain each unique token, in CSR format.
+    // tokenSentences[tokenSentOffsets[i]] to tokenSentences[tokenSentOffsets[i + 1]] are the sentences that contain token i
+    const int* tokenSentOffsets;
+    const int* tokenSentences;
+    // weight of each field in the score of a document
+    const float* fieldWeights;
+    // gram indices for gram lengths 2 to MAX_INT_GRAM_LEN, built on first use
+    GramIndex gramIndices[MAX_INT_GRAM_LEN + 1];
+    TypoIndex typoIndex;
+    // built on the first substring search
+    SuffixIndex suffixIndex;
+    // the shared dictionary, or NULL. If set, the gram indices above are not used
+    Dictionary* dict;
+    // the token of this searcher with each id of the dictionary, -1 if there is none
+    vector<int> localIds;
+    // the number of unique tokens of this searcher that are in the dictionary
+    int numDictTokens;
+
+    // the number of threads that score tokens and sentences. Always 1 unless compiled with USE_THREADS
+    int numThreads = 1;
+    QueryContext context;
+    ResultCache cache;
+    // the bytes of the index, the query scratch and the result cache accounted for this searcher, see syncMemory
+    int64_t memory[3] = {};
 };
 
+inline string_view getToken(const FastSearcher* searcher, int token) {
+    const auto& entry = searcher->uniqueTokens[token];
+    return {searcher->text + entry.offset, static_cast<string_view::size_type>(entry.length)};
+}
+
+inline string_view getSentence(const FastSearcher* searcher, int sentence) {
+    const auto& entry = searcher->sentences[sentence];
+    return {searcher->text + entry.textOffset, static_cast<string_view::size_type>(entry.textLength)};
+}
+
 void split(const char* sentence, vector<string_view>& result) {
     const char* it = sentence;
     while (*it != 0) {
@@ -87,9 +424,9 @@ void split(const char* sentence, vector<string_view>& result) {
 
 /**
  * The queryGram hashmap maps a string to an pointer into the frequency table, which indicates the frequency of the gram
- * 
+ *
  * Reason for an additional level of indirection is that we need to constantly restore the frequency table to its original values
- * 
+ *
  * Instead of copying the whole map, we just copy the frequency which is stored in a separate array
  * @returns a pointer to the frequency table, and its size
  * @note ptr to ptr+size is the table, ptr+size to ptr+size*2 is a copy of this table
@@ -135,223 +472,2069 @@ float compareTwoStrings(const GramMap& bigrams, string_view first, string_view s
     return (2.0f * intersectionSize) / (len1 + len2 - 2.0f);
 }
 
-vector<string_view> splitBuffer;
 
 /**
  * add a new match [start, end) to an end of the match array
  * merge it with the last match if it overlaps with it
+ * @param first the index of the first match of the current token/sentence in the array
 */
-inline void addMatchNoOverlap(vector<Match>& matches, int start, int end) {
-    if (matches.size() && matches.back().end >= start) {
+inline void addMatchNoOverlap(vector<Match>& matches, int first, int start, int end) {
+    if (static_cast<int>(matches.size()) > first && matches.back().end >= start) {
         matches.back().end = end;
     } else {
         matches.push_back({start, end});
     }
 }
 
-extern "C" {
+/**
+ * lookup table used by normalize: lower-cases ASCII letters and maps whitespace and ASCII punctuation to spaces.
+ * Other bytes (including UTF-8 multi-byte sequences) are kept as they are
+ */
+constexpr auto NORMALIZE_TABLE = [] {
+    array<char, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        char c = static_cast<char>(i);
+        if ('A' <= c && c <= 'Z')
+            table[i] = c - 'A' + 'a';
+        else if ((0 < c && c <= ' ') || c == 127 || ('!' <= c && c <= '/') || (':' <= c && c <= '@') ||
+                 ('[' <= c && c <= '`') || ('{' <= c && c <= '~'))
+            table[i] = ' ';
+        else
+            table[i] = c;
+    }
+    return table;
+}();
 
 /**
- * get a FastSearcher instance pointer
- * @param sentences an array of NULL-terminated strings. They should be .trim(), .toLowerCase(), and probably with puncturations stripped beforehand
- * @param N ths length of sentences
-*/
-FastSearcher* getSearcher(const char** sentences, int N) {
-    auto* searcher = new FastSearcher();
-    searcher->size = N;
-    searcher->indices = new int[N];
-    searcher->sentences = new Sentence[N];
-    auto& uniqueTokens = searcher->uniqueTokens;
+ * normalize a string in place. Every byte is mapped to exactly one byte,
+ * so that the positions of matches are also valid in the original string
+ */
+inline void normalize(char* it, const char* end) {
+    for (; it < end; it++) *it = NORMALIZE_TABLE[static_cast<uint8_t>(*it)];
+}
+
+inline Gram gramAt(const char* str, int gramLen) {
+    Gram gram = 0;
+    for (int i = 0; i < gramLen; i++) gram = (gram << 8) | static_cast<uint8_t>(str[i]);
+    return gram;
+}
+
+/**
+ * the integer counterpart of constructQueryGrams: the distinct grams of the query are stored in ascending order in `grams`,
+ * and the frequency of grams[i] is the i-th entry of the frequency table
+ * @returns a pointer to the frequency table, and its size
+ * @note ptr to ptr+size is the table, ptr+size to ptr+size*2 is a copy of this table
+ */
+inline pair<int16_t*, int> constructIntQueryGrams(vector<Gram>& grams, string_view query, int gramLen) {
+    const int queryGramCount = max(static_cast<int>(query.size()) - gramLen + 1, 0);
+    grams.resize(0);
+    for (int j = 0; j < queryGramCount; j++) grams.push_back(gramAt(query.data() + j, gramLen));
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    auto* freqCount = new int16_t[queryGramCount * 2]();
+    for (int j = 0; j < queryGramCount; j++)
+        freqCount[lower_bound(grams.begin(), grams.end(), gramAt(query.data() + j, gramLen)) - grams.begin()]++;
+    memcpy(freqCount + queryGramCount, freqCount, queryGramCount * sizeof(int16_t));
+    return {freqCount, queryGramCount};
+}
+
+/**
+ * find a gram in the sorted distinct grams of the query
+ * @returns the index of the gram, or -1 if it is absent
+ * @note queries are short, so with SIMD a linear scan comparing 4 grams at a time beats the binary search
+ */
+inline int findIntGram(const vector<Gram>& grams, Gram key) {
+#ifdef USE_SIMD
+    const int n = grams.size();
+    const auto keys = simd::splatInt(key);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        if (int mask = simd::eqMask(simd::loadInt(grams.data() + i), keys)) return i + __builtin_ctz(mask);
+    }
+    for (; i < n; i++) {
+        if (grams[i] == key) return i;
+    }
+    return -1;
+#else
+    auto it = lower_bound(grams.begin(), grams.end(), key);
+    return it != grams.end() && *it == key ? it - grams.begin() : -1;
+#endif
+}
+
+inline uint32_t alignUp(uint32_t offset, uint32_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * reserve space for an array of `count` elements of type T at the end of a block of memory of `size` bytes
+ * @returns the offset of the array
+ */
+template <typename T>
+inline uint32_t reserveArray(uint32_t& size, uint32_t count) {
+    uint32_t offset = alignUp(size, alignof(T));
+    size = offset + count * sizeof(T);
+    return offset;
+}
+
+/**
+ * point the arrays of the searcher to their locations in the arena
+ */
+void bindArena(FastSearcher* searcher, void* arena) {
+    const auto& layout = searcher->layout;
+    auto* base = static_cast<char*>(arena);
+    searcher->arena = arena;
+    searcher->text = base + layout.text;
+    searcher->sentences = reinterpret_cast<const SentenceEntry*>(base + layout.sentences);
+    searcher->tokenIds = reinterpret_cast<const int*>(base + layout.tokenIds);
+    searcher->tokenPositions = reinterpret_cast<const int*>(base + layout.tokenPositions);
+    searcher->uniqueTokens = reinterpret_cast<const TokenEntry*>(base + layout.uniqueTokens);
+    searcher->tokenSentOffsets = reinterpret_cast<const int*>(base + layout.tokenSentOffsets);
+    searcher->tokenSentences = reinterpret_cast<const int*>(base + layout.tokenSentences);
+    searcher->fieldWeights = reinterpret_cast<const float*>(base + layout.fieldWeights);
+}
+
+/**
+ * call f(token, position) for each token of a sentence, where position is the start of the token in the sentence
+ */
+template <typename F>
+inline void forEachToken(string_view sentence, F&& f) {
+    const char *begin = sentence.data(), *it = begin, *end = it + sentence.size();
+    // skip leading spaces
+    while (it < end && *it == ' ') it++;
+    while (it < end) {
+        const char* tokenStart = it;
+        // skip token until we hit spaces
+        while (it < end && *it != ' ') it++;
+        f(string_view(tokenStart, it - tokenStart), static_cast<int>(tokenStart - begin));
+        // skip spaces
+        while (it < end && *it == ' ') it++;
+    }
+}
+
+/**
+ * call f(gram, count) for each distinct gram of a token, in ascending order of gram
+ * @param tokenGrams a buffer for the grams of the token
+ */
+template <typename F>
+inline void forEachTokenGram(string_view token, int gramLen, vector<Gram>& tokenGrams, F&& f) {
+    const int tokenGramCount = static_cast<int>(token.size()) - gramLen + 1;
+    if (tokenGramCount <= 0) return;
+    tokenGrams.resize(0);
+    for (int j = 0; j < tokenGramCount; j++) tokenGrams.push_back(gramAt(token.data() + j, gramLen));
+    sort(tokenGrams.begin(), tokenGrams.end());
+    for (int j = 0; j < tokenGramCount;) {
+        int k = j + 1;
+        while (k < tokenGramCount && tokenGrams[k] == tokenGrams[j]) k++;
+        f(tokenGrams[j], k - j);
+        j = k;
+    }
+}
+
+/**
+ * tokenize the sentences and build the flat index of the searcher
+ * @param sentences the sentences to index. They are copied into the arena, so they can be freed after this function returns
+ * @param fieldWeights the weight of each field. The sentences are the fields of each document, in document-major order
+ */
+void buildIndex(FastSearcher* searcher, const vector<string_view>& sentences, const vector<float>& fieldWeights) {
+    STATS_TIMER(searchBuildNs);
+    Tracer::Span span{Tracer::Phase::searchBuild, static_cast<int>(sentences.size())};
+    const int N = sentences.size();
+    const int numFields = fieldWeights.size();
+    vector<SentenceEntry> sentenceEntries(N);
+    vector<int> tokenIds, tokenPositions;
+    vector<TokenEntry> uniqueTokens;
 
-    int maxTokenLen = 0;
+    int textOffset = 0, maxTokenLen = 0;
     // map a token to an index in the uniqueTokens array
     HashMap<string_view, int> str2num(N * 2);
     for (int i = 0; i < N; i++) {
-        const char* sentence = searcher->sentences[i]._original = sentences[i];
-        const char* it = sentence;
-        while (*it != 0) {
-            const char* tokenStart = it;
-            // skip token until we hit spaces
-            while (*it != ' ' && *it != 0) it++;
-            string_view token(tokenStart, it - tokenStart);
-
+        auto sentence = sentences[i];
+        auto& entry = sentenceEntries[i];
+        entry.textOffset = textOffset;
+        entry.textLength = sentence.size();
+        entry.tokenOffset = tokenIds.size();
+        forEachToken(sentence, [&](string_view token, int position) {
             auto [mit, success] = str2num.insert({token, uniqueTokens.size()});
             if (success)  // if new unique token, add it to unique token list
-                uniqueTokens.push_back({token, 0.0f});
+                uniqueTokens.push_back({textOffset + position, static_cast<int>(token.size())});
             // record the position of this token in the unique token list
-            searcher->sentences[i].tokens.push_back({{mit->second}, static_cast<int>(tokenStart - sentence)});
-            // skip spaces
-            while (*it == ' ' && *it != 0) it++;
-        }
-        searcher->sentences[i].original = {sentence, static_cast<string_view::size_type>(it - sentence)};
-        maxTokenLen = max(maxTokenLen, static_cast<int>(searcher->sentences[i].tokens.size()));
+            tokenIds.push_back(mit->second);
+            tokenPositions.push_back(position);
+        });
+        entry.tokenCount = tokenIds.size() - entry.tokenOffset;
+        maxTokenLen = max(maxTokenLen, entry.tokenCount);
+        textOffset += sentence.size() + 1;
     }
-    // free the string array, but not strings themselves
-    free((void*)sentences);
-    uniqueTokens.shrink_to_fit();
-    searcher->scoreWindow = new float[maxTokenLen];
+    const int numUnique = uniqueTokens.size();
+    const int numTokens = tokenIds.size();
 
-    // note: we can only assign pointers into uniqueTokens here (no reallocations will occur after this point)
-    // otherwise they might be invalid
+    // count the sentences of each token first, then fill them in
+    // the last sentence recorded for each token, used to skip duplicated tokens in a sentence
+    vector<int> lastSentence(numUnique, -1);
+    vector<int> tokenSentOffsets(numUnique + 1, 0);
     for (int i = 0; i < N; i++) {
-        for (auto& token : searcher->sentences[i].tokens) {
-            token.token = &uniqueTokens[token.idx];
+        for (int j = sentenceEntries[i].tokenOffset, end = j + sentenceEntries[i].tokenCount; j < end; j++) {
+            int token = tokenIds[j];
+            if (lastSentence[token] == i) continue;
+            lastSentence[token] = i;
+            tokenSentOffsets[token + 1]++;
         }
     }
-#ifdef DEBUG_LOG
-    int numTokens = 0;
+    for (int i = 0; i < numUnique; i++) tokenSentOffsets[i + 1] += tokenSentOffsets[i];
+
+    // lay out the arena and copy everything into it
+    auto& layout = searcher->layout;
+    layout.size = 0;
+    layout.text = reserveArray<char>(layout.size, textOffset);
+    layout.sentences = reserveArray<SentenceEntry>(layout.size, N);
+    layout.tokenIds = reserveArray<int>(layout.size, numTokens);
+    layout.tokenPositions = reserveArray<int>(layout.size, numTokens);
+    layout.uniqueTokens = reserveArray<TokenEntry>(layout.size, numUnique);
+    layout.tokenSentOffsets = reserveArray<int>(layout.size, numUnique + 1);
+    layout.tokenSentences = reserveArray<int>(layout.size, tokenSentOffsets[numUnique]);
+    layout.fieldWeights = reserveArray<float>(layout.size, numFields);
+    auto* arena = static_cast<char*>(malloc(layout.size));
     for (int i = 0; i < N; i++) {
-        numTokens += searcher->sentences[i].tokens.size();
+        auto* dest = arena + layout.text + sentenceEntries[i].textOffset;
+        memcpy(dest, sentences[i].data(), sentences[i].size());
+        dest[sentences[i].size()] = 0;
     }
-    cout << "num tokens: " << numTokens << " | num unique: " << uniqueTokens.size() << endl;
+    memcpy(arena + layout.sentences, sentenceEntries.data(), N * sizeof(SentenceEntry));
+    memcpy(arena + layout.tokenIds, tokenIds.data(), numTokens * sizeof(int));
+    memcpy(arena + layout.tokenPositions, tokenPositions.data(), numTokens * sizeof(int));
+    memcpy(arena + layout.uniqueTokens, uniqueTokens.data(), numUnique * sizeof(TokenEntry));
+    memcpy(arena + layout.tokenSentOffsets, tokenSentOffsets.data(), (numUnique + 1) * sizeof(int));
+    memcpy(arena + layout.fieldWeights, fieldWeights.data(), numFields * sizeof(float));
+    auto* tokenSentences = reinterpret_cast<int*>(arena + layout.tokenSentences);
+    fill(lastSentence.begin(), lastSentence.end(), -1);
+    for (int i = 0; i < N; i++) {
+        for (int j = sentenceEntries[i].tokenOffset, end = j + sentenceEntries[i].tokenCount; j < end; j++) {
+            int token = tokenIds[j];
+            if (lastSentence[token] == i) continue;
+            lastSentence[token] = i;
+            tokenSentences[tokenSentOffsets[token]++] = i;
+        }
+    }
+
+    searcher->size = N;
+    searcher->textSize = textOffset;
+    searcher->numPostedTokens = numUnique;
+    searcher->numDocs = N / numFields;
+    searcher->numFields = numFields;
+    searcher->numUnique = numUnique;
+    searcher->maxTokenLen = maxTokenLen;
+    bindArena(searcher, arena);
+#ifdef DEBUG_LOG
+    cout << "num tokens: " << numTokens << " | num unique: " << numUnique << " | index size: " << layout.size << endl;
 #endif
-    return searcher;
 }
 
 /**
- * Adapted from [[https://github.com/aceakash/string-similarity]], with optimizations
- * MIT License
- * @param _query a dynamically allocated string. It will be freed before this function returns.
+ * allocate the buffers used by queries. When the index grows, this is called again after the state is reset, to grow the buffers
  */
-int findBestMatch(FastSearcher* searcher, const char* _query) {
-    string_view query(_query);
-    GramMap queryGrams;
-    auto [freqCount, queryGramCount] = constructQueryGrams(queryGrams, query, 2);
+void initQueryState(FastSearcher* searcher) {
+    const int N = searcher->size, numDocs = searcher->numDocs, numUnique = searcher->numUnique;
+    delete[] searcher->context.scoreWindow;
+    delete[] searcher->context.indices;
+    searcher->context.scoreWindow = new float[searcher->maxTokenLen * searcher->numThreads];
+    searcher->context.indices = new int[numDocs];
+    searcher->context.numResults = 0;
+    auto& state = searcher->context.state;
+    state.intersections.resize(numUnique, 0);
+    state.tokenScores.resize(numUnique, 0.0f);
+    state.tokenWords.resize(numUnique, -1);
+    state.isTypoToken.resize(numUnique, 0);
+    state.sentenceScores.resize(N, 0.0f);
+    state.isCandidate.resize(N, 0);
+    if (searcher->numFields > 1) {
+        state.docScores.resize(numDocs, 0.0f);
+        state.isDocCandidate.resize(numDocs, 0);
+    }
+    auto& matchState = searcher->context.matchState;
+    matchState.tokenQuery.resize(numUnique, -1);
+    matchState.tokenMatchOffsets.resize(numUnique);
+    matchState.tokenMatchSizes.resize(numUnique);
+    matchState.resultOffsets.resize(1, 0);
+}
 
-    float bestMatchRating = 0.0f;
-    int bestMatchIndex = 0;
-    for (int i = 0; i < searcher->size; i++) {
-        float currentRating = compareTwoStrings(queryGrams, query, searcher->sentences[i].original);
-        if (currentRating > bestMatchRating) {
-            bestMatchIndex = i;
-            bestMatchRating = currentRating;
+/**
+ * build the gram index of the given gram length for `numTokens` tokens
+ * @param tokenAt returns the i-th token
+ */
+template <typename F>
+void buildGramIndex(GramIndex& index, int gramLen, int numTokens, F&& tokenAt) {
+    struct Entry {
+        Gram gram;
+        Posting posting;
+    };
+    vector<Entry> entries;
+    vector<Gram> tokenGrams;
+    for (int i = 0; i < numTokens; i++) {
+        // one entry for each distinct gram of this token
+        forEachTokenGram(tokenAt(i), gramLen, tokenGrams,
+                         [&](Gram gram, int count) { entries.push_back({gram, {i, count}}); });
+    }
+    // stable: postings of each gram are kept in token order
+    stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.gram < b.gram; });
+    const int numEntries = entries.size();
+    int numGrams = 0;
+    for (int i = 0; i < numEntries; i++)
+        numGrams += i == 0 || entries[i].gram != entries[i - 1].gram;
+
+    uint32_t size = 0;
+    uint32_t gramsOffset = reserveArray<Gram>(size, numGrams);
+    uint32_t offsetsOffset = reserveArray<int>(size, numGrams + 1);
+    uint32_t postingsOffset = reserveArray<Posting>(size, numEntries);
+    auto* mem = static_cast<char*>(malloc(size));
+    index.mem = mem;
+    index.grams = reinterpret_cast<Gram*>(mem + gramsOffset);
+    index.offsets = reinterpret_cast<int*>(mem + offsetsOffset);
+    index.postings = reinterpret_cast<Posting*>(mem + postingsOffset);
+    index.size = 0;
+    for (int i = 0; i < numEntries; i++) {
+        if (i == 0 || entries[i].gram != entries[i - 1].gram) {
+            index.grams[index.size] = entries[i].gram;
+            index.offsets[index.size++] = i;
         }
-        memcpy(freqCount, freqCount + queryGramCount, queryGramCount * sizeof(int16_t));
+        index.postings[i] = entries[i].posting;
     }
-    searcher->sentences[bestMatchIndex].score = bestMatchRating;
-    free((void*)_query);
-    delete[] freqCount;
-    return bestMatchIndex;
+    index.offsets[index.size] = numEntries;
+    index.gramLen = gramLen;
+    index.numTokens = numTokens;
 }
 
 /**
- * sliding window search
- * @param _query a dynamically allocated string. It will be freed after this function returns.
-*/
-int* sWSearch(FastSearcher* searcher, const char* _query, const int numResults, const int gramLen, const float threshold) {
-    string_view query(_query);
-    splitBuffer.resize(0);
-    split(_query, splitBuffer);
+ * get the gram index of the given gram length, building it if it has not been built before
+ */
+const GramIndex& getGramIndex(FastSearcher* searcher, int gramLen) {
+    auto& index = searcher->gramIndices[gramLen];
+    if (index.gramLen != gramLen)
+        buildGramIndex(index, gramLen, searcher->numUnique, [searcher](int i) { return getToken(searcher, i); });
+    return index;
+}
 
-    int len = searcher->uniqueTokens.size();
-    int maxWindow = max((int)splitBuffer.size(), 2);
-    {
-        GramMap queryGrams;
-        auto [freqCount, queryGramCount] = constructQueryGrams(queryGrams, query, gramLen);
-
-        // compute score and match for each unique token
-        for (int i = 0; i < len; i++) {
-            auto& token = searcher->uniqueTokens[i];
-            const int tokenGramCount = static_cast<int>(token.token.size()) - gramLen + 1;
-            if (tokenGramCount <= 0) {
-                token.score = 0.0f;
-                continue;
-            }
+/**
+ * append the postings of a token added after the gram indices were built.
+ * An index whose appended postings outgrow half of its CSR arrays is dropped instead, and rebuilt with all tokens on its next use.
+ * The rebuilt index has the same postings in the same order, so the query states that refer to it stay valid
+ */
+void addTokenGrams(GramIndex* indices, int id, string_view token) {
+    vector<Gram> tokenGrams;
+    for (int gramLen = 2; gramLen <= MAX_INT_GRAM_LEN; gramLen++) {
+        auto& index = indices[gramLen];
+        if (index.gramLen != gramLen) continue;
+        forEachTokenGram(token, gramLen, tokenGrams, [&](Gram gram, int count) {
+            index.extra[gram].push_back({id, count});
+            index.numExtra++;
+        });
+        if (index.numExtra > index.offsets[index.size] / 2 + MIN_COMPACTION_POSTINGS) {
+            free(index.mem);
+            index = GramIndex();
+        }
+    }
+}
 
-            int intersectionSize = 0;
-            token.matches.resize(0);  // clear previous matches
-            for (int j = 0; j < tokenGramCount; j++) {
-                auto it = queryGrams.find(token.token.substr(j, gramLen));
-                if (it != queryGrams.end() && *(it->second) > 0) {
-                    *it->second -= 1;  // decrement the frequency (don't want this gram to be matched again)
-                    intersectionSize++;
-                    addMatchNoOverlap(token.matches, j, j + gramLen);
-                }
-            }
-            // intersection over union
-            token.score = (2.0f * intersectionSize) / (queryGramCount + tokenGramCount);
+/**
+ * clear the state of the last query, so that the next query starts from scratch
+ */
+void resetQueryState(FastSearcher* searcher, int gramLen) {
+    auto& state = searcher->context.state;
+    for (int i : state.matchedTokens) {
+        state.intersections[i] = 0;
+        state.tokenScores[i] = 0.0f;
+        state.tokenWords[i] = -1;
+    }
+    for (int i : state.typoTokens) {
+        state.isTypoToken[i] = 0;
+        state.tokenScores[i] = 0.0f;
+        state.tokenWords[i] = -1;
+    }
+    for (int i : state.candidates) {
+        state.isCandidate[i] = 0;
+        state.sentenceScores[i] = 0.0f;
+    }
+    state.matchedTokens.resize(0);
+    state.typoTokens.resize(0);
+    state.candidates.resize(0);
+    state.gramFreq.clear();
+    state.query.clear();
+    state.gramLen = gramLen;
+    state.dictMatched = 0;
+}
 
-            // restore frequency table to its original state
-            memcpy(freqCount, freqCount + queryGramCount, queryGramCount * sizeof(int16_t));
+/**
+ * add the sentences containing a token to the candidates
+ */
+inline void addCandidates(FastSearcher* searcher, int token) {
+    auto& state = searcher->context.state;
+    auto addCandidate = [&state](int sentence) {
+        if (!state.isCandidate[sentence]) {
+            state.isCandidate[sentence] = 1;
+            state.candidates.push_back(sentence);
         }
-        delete[] freqCount;
+    };
+    if (token < searcher->numPostedTokens) {
+        for (int j = searcher->tokenSentOffsets[token], end = searcher->tokenSentOffsets[token + 1]; j < end; j++)
+            addCandidate(searcher->tokenSentences[j]);
     }
+    // the sentences added since the index was built. Sentences that no longer contain the token may be added,
+    // which is harmless because they are scored by the tokens they contain now
+    if (searcher->mut) {
+        const auto& postings = searcher->mut->postings;
+        for (int j = searcher->mut->postingHeads[token]; j != -1; j = postings[j].second) addCandidate(postings[j].first);
+    }
+}
+
+/**
+ * record that the intersection of a token with the query is now nonzero,
+ * and add the sentences containing it to the candidates
+ */
+inline void addMatchedToken(FastSearcher* searcher, int token) {
+    searcher->context.state.matchedTokens.push_back(token);
+    addCandidates(searcher, token);
+}
 
-    len = searcher->size;
-    // compute score and matches for each sentence
-    for (int i = 0; i < len; i++) {
-        auto& sentence = searcher->sentences[i];
-        sentence.matches.resize(0);
+/**
+ * FNV-1a
+ */
+inline uint32_t hashString(string_view str) {
+    uint32_t hash = 2166136261u;
+    for (char c : str) hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    return hash;
+}
 
-        const int tokenLen = sentence.tokens.size();
+/**
+ * append the hashes of the word and of all strings obtained by deleting at most `distance` characters from it, at positions >= start.
+ * There may be duplicates if the word contains repeated characters
+ * @note the word is restored before returning
+ */
+void addDeletions(string& word, int start, int distance, vector<uint32_t>& hashes) {
+    hashes.push_back(hashString(word));
+    if (distance == 0 || word.size() <= 1) return;
+    for (int i = start; i < static_cast<int>(word.size()); i++) {
+        char c = word[i];
+        word.erase(i, 1);
+        addDeletions(word, i, distance - 1, hashes);
+        word.insert(i, 1, c);
+    }
+}
 
-        // use the number of words as the window size in this string if maxWindow > number of words
-        const int window = min(maxWindow, tokenLen);
+/**
+ * optimal string alignment distance: the Levenshtein distance, with transpositions of adjacent characters counted as one edit
+ */
+int editDistance(string_view a, string_view b) {
+    const int m = a.size(), n = b.size();
+    // the last three rows of the DP table
+    vector<int> prev2(n + 1), prev(n + 1), cur(n + 1);
+    for (int j = 0; j <= n; j++) prev[j] = j;
+    for (int i = 1; i <= m; i++) {
+        cur[0] = i;
+        for (int j = 1; j <= n; j++) {
+            int cost = a[i - 1] != b[j - 1];
+            cur[j] = min({prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + cost});
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1])
+                cur[j] = min(cur[j], prev2[j - 2] + 1);
+        }
+        swap(prev2, prev);
+        swap(prev, cur);
+    }
+    return prev[n];
+}
 
-        float score = 0, maxScore = 0;
-        // initialize score window
-        for (int j = 0; j < window; j++) {
-            auto token = sentence.tokens[j].token;
-            score += searcher->scoreWindow[j] = token->score;
+/**
+ * build the deletion index of the unique tokens for edit distances up to maxDistance
+ */
+void buildTypoIndex(FastSearcher* searcher, int maxDistance) {
+    auto& index = searcher->typoIndex;
+    free(index.mem);
 
-            if (token->score < threshold) continue;
-            // add token matches to sentence matches
-            for (auto match : token->matches)
-                addMatchNoOverlap(sentence.matches, sentence.tokens[j].index + match.start, sentence.tokens[j].index + match.end);
+    struct Entry {
+        uint32_t hash;
+        int token;
+    };
+    vector<Entry> entries;
+    vector<uint32_t> hashes;
+    string word;
+    for (int i = 0; i < searcher->numUnique; i++) {
+        auto token = getToken(searcher, i);
+        if (static_cast<int>(token.size()) < MIN_TYPO_LEN) continue;
+        word = token;
+        hashes.resize(0);
+        addDeletions(word, 0, maxDistance, hashes);
+        sort(hashes.begin(), hashes.end());
+        hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+        for (auto hash : hashes) entries.push_back({hash, i});
+    }
+    sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.hash < b.hash || (a.hash == b.hash && a.token < b.token);
+    });
+    const int numEntries = entries.size();
+    int numHashes = 0;
+    for (int i = 0; i < numEntries; i++)
+        numHashes += i == 0 || entries[i].hash != entries[i - 1].hash;
+
+    uint32_t size = 0;
+    uint32_t hashesOffset = reserveArray<uint32_t>(size, numHashes);
+    uint32_t offsetsOffset = reserveArray<int>(size, numHashes + 1);
+    uint32_t tokensOffset = reserveArray<int>(size, numEntries);
+    auto* mem = static_cast<char*>(malloc(size));
+    index.mem = mem;
+    index.hashes = reinterpret_cast<uint32_t*>(mem + hashesOffset);
+    index.offsets = reinterpret_cast<int*>(mem + offsetsOffset);
+    index.tokens = reinterpret_cast<int*>(mem + tokensOffset);
+    index.size = 0;
+    for (int i = 0; i < numEntries; i++) {
+        if (i == 0 || entries[i].hash != entries[i - 1].hash) {
+            index.hashes[index.size] = entries[i].hash;
+            index.offsets[index.size++] = i;
         }
-        if (score > maxScore) maxScore = score;
+        index.tokens[i] = entries[i].token;
+    }
+    index.offsets[index.size] = numEntries;
+    index.builtDistance = maxDistance;
+    index.numTokens = searcher->numUnique;
+#ifdef DEBUG_LOG
+    cout << "typo index: " << numHashes << " deletions | " << numEntries << " entries" << endl;
+#endif
+}
+
+/**
+ * look up the tokens within a small edit distance of each query word, and raise their scores to their typo scores if those are higher.
+ * The typo score of a token is weight * (1 - distance / length), scaled in the same way as the n-gram score
+ * so that an exact match of a one-word query scores 1
+ * @param words the words of the query
+ */
+void addTypoMatches(FastSearcher* searcher, const vector<string_view>& words, int queryGramCount, int gramLen) {
+    const auto& index = searcher->typoIndex;
+    auto& state = searcher->context.state;
+    vector<uint32_t> hashes;
+    vector<int> tokens;
+    string word;
+    for (int k = 0, numWords = words.size(); k < numWords; k++) {
+        const auto w = words[k];
+        const int wordLen = w.size();
+        // allow one edit for every three characters
+        const int maxDistance = min(index.maxDistance, wordLen / MIN_TYPO_LEN);
+        if (maxDistance == 0) continue;
 
-        for (int j = window; j < tokenLen; j++) {
-            // subtract the last score and add the new score
-            score -= searcher->scoreWindow[j - window];
-            auto token = sentence.tokens[j].token;
-            score += searcher->scoreWindow[j] = token->score;
+        word = w;
+        hashes.resize(0);
+        tokens.resize(0);
+        addDeletions(word, 0, maxDistance, hashes);
+        for (auto hash : hashes) {
+            auto* it = lower_bound(index.hashes, index.hashes + index.size, hash);
+            if (it == index.hashes + index.size || *it != hash) continue;
+            int i = it - index.hashes;
+            tokens.insert(tokens.end(), index.tokens + index.offsets[i], index.tokens + index.offsets[i + 1]);
+        }
+        for (int i = index.numTokens; i < searcher->numUnique; i++) tokens.push_back(i);
+        sort(tokens.begin(), tokens.end());
+        tokens.erase(unique(tokens.begin(), tokens.end()), tokens.end());
 
-            if (token->score < threshold) continue;
-            if (score > maxScore) maxScore = score;
+        const int wordGramCount = max(wordLen - gramLen + 1, 1);
+        for (int token : tokens) {
+            auto str = getToken(searcher, token);
+            const int tokenLen = str.size();
+            if (tokenLen < MIN_TYPO_LEN || abs(tokenLen - wordLen) > maxDistance) continue;
+            int distance = editDistance(w, str);
+            if (distance > maxDistance) continue;
 
-            // add token matches to sentence matches
-            for (auto match : token->matches)
-                addMatchNoOverlap(sentence.matches, sentence.tokens[j].index + match.start, sentence.tokens[j].index + match.end);
+            const int tokenGramCount = max(tokenLen - gramLen + 1, 1);
+            float similarity = 1.0f - static_cast<float>(distance) / max(tokenLen, wordLen);
+            float score = index.weight * similarity * (2.0f * wordGramCount) / (queryGramCount + tokenGramCount);
+            if (score <= state.tokenScores[token]) continue;
+            state.tokenScores[token] = score;
+            // tokens matched by grams keep the word of their first gram
+            if (state.tokenWords[token] == -1) state.tokenWords[token] = k;
+            if (!state.isTypoToken[token]) {
+                state.isTypoToken[token] = 1;
+                state.typoTokens.push_back(token);
+                addCandidates(searcher, token);
+            }
         }
-        sentence.score = maxScore;
     }
-    for (int i = 0; i < len; i++) {
-        searcher->indices[i] = i;
+}
+
+/**
+ * append a gram to the query and update the intersections of the tokens that contain it
+ * @param word the index of the query word that the gram starts in
+ * @param onMatch called with each token whose intersection becomes nonzero
+ */
+template <typename F>
+inline void addQueryGram(QueryState& state, const GramIndex& index, Gram gram, int word, F&& onMatch) {
+    // number of occurrences of this gram in the query before it is appended
+    int& freq = state.gramFreq[gram];
+    auto addPosting = [&](const Posting& posting) {
+        // this occurrence can only be matched if the token has more occurrences of this gram than already matched
+        if (posting.count > freq && state.intersections[posting.token]++ == 0) {
+            state.tokenWords[posting.token] = word;
+            onMatch(posting.token);
+        }
+    };
+    auto* it = lower_bound(index.grams, index.grams + index.size, gram);
+    if (it != index.grams + index.size && *it == gram) {
+        int i = it - index.grams;
+        for (int j = index.offsets[i], end = index.offsets[i + 1]; j < end; j++) addPosting(index.postings[j]);
     }
-    if (len > numResults) {
-        std::partial_sort(
-            searcher->indices,
-            searcher->indices + numResults, searcher->indices + len,
-            [searcher](int a, int b) {
-                return searcher->sentences[b].score < searcher->sentences[a].score;
-            });
-    } else {
-        std::sort(
-            searcher->indices,
-            searcher->indices + len,
-            [searcher](int a, int b) {
-                return searcher->sentences[b].score < searcher->sentences[a].score;
-            });
+    if (!index.extra.empty()) {
+        auto extra = index.extra.find(gram);
+        if (extra != index.extra.end())
+            for (const auto& posting : extra->second) addPosting(posting);
     }
-    free((void*)_query);
-    return searcher->indices;
+    freq++;
 }
 
-const Match* getMatches(const FastSearcher* searcher, int idx) {
-    return searcher->sentences[idx].matches.data();
+inline string_view getToken(const Dictionary& dict, int token) {
+    const auto& entry = dict.tokens[token];
+    return {dict.text.data() + entry.offset, static_cast<string_view::size_type>(entry.length)};
 }
-int getMatchSize(const FastSearcher* searcher, int idx) {
-    return searcher->sentences[idx].matches.size();
+
+/**
+ * clear the tokens matched by the last query of the dictionary, so that the next query starts from scratch
+ */
+void resetDictionaryState(Dictionary& dict, int gramLen) {
+    auto& state = dict.state;
+    for (int i : state.matchedTokens) {
+        state.intersections[i] = 0;
+        state.tokenWords[i] = -1;
+    }
+    state.matchedTokens.resize(0);
+    state.gramFreq.clear();
+    state.query.clear();
+    state.gramLen = gramLen;
+    dict.generation++;
 }
-float getScore(const FastSearcher* searcher, int idx) {
-    return searcher->sentences[idx].score;
+
+/**
+ * map the unique tokens of the searcher that are not mapped yet to the dictionary, adding those that are new to it
+ */
+void syncDictionary(FastSearcher* searcher) {
+    auto& dict = *searcher->dict;
+    auto& localIds = searcher->localIds;
+    const int numTokens = dict.tokens.size();
+    for (int i = searcher->numDictTokens; i < searcher->numUnique; i++) {
+        auto token = getToken(searcher, i);
+        auto [it, inserted] = dict.ids.try_emplace(string(token), dict.tokens.size());
+        const int id = it->second;
+        if (inserted) {
+            dict.tokens.push_back({static_cast<int>(dict.text.size()), static_cast<int>(token.size())});
+            dict.text.insert(dict.text.end(), token.begin(), token.end());
+            dict.text.push_back(0);
+            addTokenGrams(dict.gramIndices, id, token);
+        }
+        if (id >= static_cast<int>(localIds.size())) localIds.resize(id + 1, -1);
+        localIds[id] = i;
+    }
+    searcher->numDictTokens = searcher->numUnique;
+    // the new tokens have not been matched against the last query of the dictionary
+    if (static_cast<int>(dict.tokens.size()) > numTokens) {
+        dict.state.intersections.resize(dict.tokens.size(), 0);
+        dict.state.tokenWords.resize(dict.tokens.size(), -1);
+        resetDictionaryState(dict, 0);
+    }
+}
+
+/**
+ * match the tokens of the dictionary against a query, in the same way as sWSearch does for the tokens of a searcher.
+ * If the query extends the last query of the dictionary, only the grams that are appended are processed
+ * @param wordAt returns the index of the query word at the given offset
+ */
+template <typename F>
+void matchDictionary(Dictionary& dict, string_view query, int gramLen, F&& wordAt) {
+    auto& index = dict.gramIndices[gramLen];
+    if (index.gramLen != gramLen)
+        buildGramIndex(index, gramLen, dict.tokens.size(), [&dict](int i) { return getToken(dict, i); });
+
+    auto& state = dict.state;
+    int from = 0;
+    if (state.gramLen == gramLen && query.substr(0, state.query.size()) == state.query) {
+        from = max(static_cast<int>(state.query.size()) - gramLen + 1, 0);
+    } else {
+        resetDictionaryState(dict, gramLen);
+    }
+    const int queryGramCount = static_cast<int>(query.size()) - gramLen + 1;
+    for (int j = from; j < queryGramCount; j++)
+        addQueryGram(state, index, gramAt(query.data() + j, gramLen), wordAt(j), [&state](int token) { state.matchedTokens.push_back(token); });
+    state.query = query;
+}
+
+/**
+ * compute the score of each document that has a candidate field, as the weighted sum of the scores of its fields.
+ * The other documents have a score of 0
+ */
+void computeDocScores(FastSearcher* searcher) {
+    auto& state = searcher->context.state;
+    for (int i : state.docCandidates) {
+        state.isDocCandidate[i] = 0;
+        state.docScores[i] = 0.0f;
+    }
+    state.docCandidates.resize(0);
+    const int numFields = searcher->numFields;
+    for (int i : state.candidates) {
+        int doc = i / numFields;
+        if (!state.isDocCandidate[doc]) {
+            state.isDocCandidate[doc] = 1;
+            state.docCandidates.push_back(doc);
+        }
+    }
+    for (int doc : state.docCandidates) {
+        const float* fieldScores = state.sentenceScores.data() + doc * numFields;
+        float score = 0.0f;
+        for (int f = 0; f < numFields; f++) score += searcher->fieldWeights[f] * fieldScores[f];
+        state.docScores[doc] = score;
+    }
+}
+
+/**
+ * the key of a query in the result cache: the query, followed by the other parameters of sWSearch in binary
+ */
+string resultCacheKey(const char* query, int numResults, int gramLen, float threshold) {
+    string key(query);
+    key.push_back(0);
+    key.append(reinterpret_cast<const char*>(&numResults), sizeof(numResults));
+    key.append(reinterpret_cast<const char*>(&gramLen), sizeof(gramLen));
+    key.append(reinterpret_cast<const char*>(&threshold), sizeof(threshold));
+    return key;
+}
+
+inline size_t savedStateBytes(const SavedQueryState& state) {
+    return state.query.size() + state.gramFreq.size() * sizeof(pair<Gram, int>) + state.matchedTokens.size() * 3 * sizeof(int) +
+           state.candidates.size() * sizeof(int);
+}
+
+inline size_t cachedResultBytes(const CachedResult& entry) {
+    return sizeof(CachedResult) + entry.key.size() + entry.indices.size() * sizeof(int) + entry.fieldScores.size() * sizeof(float) +
+           entry.resultOffsets.size() * sizeof(int) + entry.resultMatches.size() * sizeof(Match) + savedStateBytes(entry.state);
+}
+
+void clearResultCache(FastSearcher* searcher) {
+    auto& cache = searcher->cache;
+    cache.lookup.clear();
+    cache.entries.clear();
+    cache.bytes = 0;
+}
+
+/**
+ * restore the results of a cached query, as if it had just been run. The scores of the documents that are not in the results are 0.
+ * The matched tokens and the candidates are restored as well if they were kept, so that the next query can extend this one
+ * @returns false if the query is not in the cache
+ */
+bool restoreCachedResult(FastSearcher* searcher, const string& key) {
+    auto& cache = searcher->cache;
+    auto it = cache.lookup.find(key);
+    if (it == cache.lookup.end()) return false;
+    cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+    const auto& entry = *it->second;
+
+    resetQueryState(searcher, 0);
+    auto& state = searcher->context.state;
+    const auto& saved = entry.state;
+    if (saved.gramLen > 0) {
+        state.query = saved.query;
+        state.gramLen = saved.gramLen;
+        for (const auto& [gram, freq] : saved.gramFreq) state.gramFreq[gram] = freq;
+        for (int k = 0, n = saved.matchedTokens.size(); k < n; k++) {
+            const int i = saved.matchedTokens[k];
+            state.intersections[i] = saved.intersections[k];
+            state.tokenWords[i] = saved.tokenWords[k];
+        }
+        state.matchedTokens = saved.matchedTokens;
+        for (int i : saved.candidates) state.isCandidate[i] = 1;
+        state.candidates = saved.candidates;
+        state.dictGeneration = saved.dictGeneration;
+        state.dictMatched = saved.dictMatched;
+    }
+    // scores are read from the state, so the scores of the results are written back to it
+    const int numFields = searcher->numFields, total = entry.indices.size();
+    for (int k = 0; k < total * numFields; k++) {
+        const int sentence = entry.indices[k / numFields] * numFields + k % numFields;
+        if (!state.isCandidate[sentence]) {
+            state.isCandidate[sentence] = 1;
+            state.candidates.push_back(sentence);
+        }
+        state.sentenceScores[sentence] = entry.fieldScores[k];
+    }
+    if (numFields > 1) computeDocScores(searcher);
+
+    copy(entry.indices.begin(), entry.indices.end(), searcher->context.indices);
+    searcher->context.numResults = total;
+    auto& matchState = searcher->context.matchState;
+    matchState.resultOffsets = entry.resultOffsets;
+    matchState.resultMatches = entry.resultMatches;
+    return true;
+}
+
+/**
+ * keep the matched tokens and the candidates of the last query with its results, see SavedQueryState
+ */
+void saveQueryState(const QueryState& state, SavedQueryState& saved) {
+    saved.query = state.query;
+    saved.gramLen = state.gramLen;
+    saved.gramFreq.assign(state.gramFreq.begin(), state.gramFreq.end());
+    saved.matchedTokens = state.matchedTokens;
+    saved.intersections.resize(state.matchedTokens.size());
+    saved.tokenWords.resize(state.matchedTokens.size());
+    for (int k = 0, n = state.matchedTokens.size(); k < n; k++) {
+        saved.intersections[k] = state.intersections[state.matchedTokens[k]];
+        saved.tokenWords[k] = state.tokenWords[state.matchedTokens[k]];
+    }
+    saved.candidates = state.candidates;
+    saved.dictGeneration = state.dictGeneration;
+    saved.dictMatched = state.dictMatched;
+}
+
+/**
+ * add the results of the last query to the cache, evicting the least recently used queries if it is full.
+ * Results that would take more than an eighth of the cache are not cached. The state of the query is only kept if it fits as well
+ */
+void cacheResult(FastSearcher* searcher, const string& key) {
+    const auto& context = searcher->context;
+    const int numFields = searcher->numFields, total = context.numResults;
+    CachedResult entry;
+    entry.key = key;
+    entry.indices.assign(context.indices, context.indices + total);
+    entry.fieldScores.resize(total * numFields);
+    for (int k = 0; k < total * numFields; k++)
+        entry.fieldScores[k] = context.state.sentenceScores[context.indices[k / numFields] * numFields + k % numFields];
+    entry.resultOffsets = context.matchState.resultOffsets;
+    entry.resultMatches = context.matchState.resultMatches;
+    // queries with long grams are matched from scratch, so their state is not kept
+    if (context.state.gramLen > 0) {
+        saveQueryState(context.state, entry.state);
+        if (cachedResultBytes(entry) > MAX_CACHE_BYTES / 8) entry.state = SavedQueryState();
+    }
+    const size_t bytes = cachedResultBytes(entry);
+    if (bytes > MAX_CACHE_BYTES / 8) return;
+    // over the memory budget, results are not cached, and the cached results are released
+    if (!Memory::fits(bytes)) {
+        clearResultCache(searcher);
+        Memory::degrade(MEMORY_UNCACHED_RESULTS);
+        return;
+    }
+
+    auto& cache = searcher->cache;
+    while (!cache.entries.empty() &&
+           (static_cast<int>(cache.entries.size()) >= MAX_CACHED_RESULTS || cache.bytes + bytes > MAX_CACHE_BYTES)) {
+        cache.bytes -= cachedResultBytes(cache.entries.back());
+        cache.lookup.erase(cache.entries.back().key);
+        cache.entries.pop_back();
+    }
+    cache.entries.push_front(move(entry));
+    cache.lookup[cache.entries.front().key] = cache.entries.begin();
+    cache.bytes += bytes;
+}
+
+/**
+ * build the suffix array of the text by prefix doubling, in O(n log n), then the LCP array by Kasai's algorithm, in O(n)
+ */
+const SuffixIndex& getSuffixIndex(FastSearcher* searcher) {
+    auto& index = searcher->suffixIndex;
+    if (index.mem) return index;
+
+    const auto* text = reinterpret_cast<const uint8_t*>(searcher->text);
+    const int n = searcher->textSize;
+    uint32_t size = 0;
+    uint32_t suffixesOffset = reserveArray<int>(size, n);
+    uint32_t lcpOffset = reserveArray<int>(size, n);
+    auto* mem = static_cast<char*>(malloc(size + 1));
+    auto* sa = reinterpret_cast<int*>(mem + suffixesOffset);
+    auto* lcp = reinterpret_cast<int*>(mem + lcpOffset);
+
+    // rank[i] is the rank of suffix i among all suffixes, compared by their first k characters
+    vector<int> rank(n), tmp(n), count(max(n, 256) + 1);
+    for (int i = 0; i < n; i++) count[rank[i] = text[i]]++;
+    for (int i = 1; i <= 256; i++) count[i] += count[i - 1];
+    for (int i = n - 1; i >= 0; i--) sa[--count[rank[i]]] = i;
+    for (int k = 1; k < n; k <<= 1) {
+        // radix sort by (rank[i], rank[i + k]). Suffixes with i + k >= n have the smallest second key
+        int p = 0;
+        for (int i = n - k; i < n; i++) tmp[p++] = i;
+        for (int j = 0; j < n; j++)
+            if (sa[j] >= k) tmp[p++] = sa[j] - k;
+        fill(count.begin(), count.end(), 0);
+        for (int i = 0; i < n; i++) count[rank[i]]++;
+        for (int i = 1; i < static_cast<int>(count.size()); i++) count[i] += count[i - 1];
+        for (int j = n - 1; j >= 0; j--) sa[--count[rank[tmp[j]]]] = tmp[j];
+
+        auto secondKey = [&](int i) { return i + k < n ? rank[i + k] : -1; };
+        tmp[sa[0]] = 0;
+        for (int j = 1; j < n; j++)
+            tmp[sa[j]] = tmp[sa[j - 1]] + (rank[sa[j]] != rank[sa[j - 1]] || secondKey(sa[j]) != secondKey(sa[j - 1]));
+        swap(rank, tmp);
+        // all ranks are distinct: the suffixes are sorted
+        if (rank[sa[n - 1]] == n - 1) break;
+    }
+
+    // Kasai: the LCP of suffix i + 1 with its predecessor is at least the LCP of suffix i with its predecessor minus 1
+    for (int i = 0; i < n; i++) rank[sa[i]] = i;
+    for (int i = 0, h = 0; i < n; i++) {
+        if (rank[i] == 0) {
+            lcp[0] = h = 0;
+            continue;
+        }
+        int j = sa[rank[i] - 1];
+        while (i + h < n && j + h < n && text[i + h] == text[j + h]) h++;
+        lcp[rank[i]] = h;
+        if (h > 0) h--;
+    }
+    index.size = n;
+    index.suffixes = sa;
+    index.lcp = lcp;
+    index.mem = mem;
+#ifdef DEBUG_LOG
+    cout << "suffix array: " << n << " suffixes" << endl;
+#endif
+    return index;
+}
+
+/**
+ * find the range of the suffix array whose suffixes start with the query, in O(|query| log n).
+ * The lower bound is found by binary search, skipping the characters known to be shared with both ends of the search range.
+ * The range is then extended with the LCP array, in O(number of occurrences)
+ * @returns [begin, end) of the range
+ */
+pair<int, int> findSuffixRange(const FastSearcher* searcher, const SuffixIndex& index, string_view query) {
+    const char* text = searcher->text;
+    const int m = query.size();
+    int lo = 0, hi = index.size, lcpLo = 0, lcpHi = 0;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const char* suffix = text + index.suffixes[mid];
+        int k = min(lcpLo, lcpHi);
+        // the text ends with a NULL character, which never matches the query
+        while (k < m && suffix[k] == query[k]) k++;
+        if (k == m || static_cast<uint8_t>(suffix[k]) > static_cast<uint8_t>(query[k])) {
+            hi = mid;
+            lcpHi = k;
+        } else {
+            lo = mid + 1;
+            lcpLo = k;
+        }
+    }
+    if (lo == index.size || strncmp(text + index.suffixes[lo], query.data(), m) != 0) return {lo, lo};
+    int end = lo + 1;
+    while (end < index.size && index.lcp[end] >= m) end++;
+    return {lo, end};
+}
+
+/**
+ * compute the matches of a token against the query grams, using the same greedy strategy as the scoring loop,
+ * and append them to the token match buffer
+ * @param findGram maps the start of a gram of the token to its entry in the frequency table, or nullptr if the query does not have it
+ * @note the frequency table is restored to its original state before returning
+ */
+template <typename F>
+inline void computeTokenMatches(FastSearcher* searcher, int tokenId, F&& findGram, int16_t* freqCount, int queryGramCount, int gramLen) {
+    auto& matchState = searcher->context.matchState;
+    auto& matches = matchState.tokenMatches;
+    auto token = getToken(searcher, tokenId);
+    const int tokenGramCount = static_cast<int>(token.size()) - gramLen + 1;
+    const int first = matches.size();
+    if (searcher->context.state.isTypoToken[tokenId]) {
+        // matched by edit distance: the whole token is matched
+        matches.push_back({0, static_cast<int>(token.size())});
+    } else {
+        for (int j = 0; j < tokenGramCount; j++) {
+            int16_t* freq = findGram(token.data() + j);
+            if (freq != nullptr && *freq > 0) {
+                *freq -= 1;
+                addMatchNoOverlap(matches, first, j, j + gramLen);
+            }
+        }
+    }
+    matchState.tokenQuery[tokenId] = searcher->context.queryId;
+    matchState.tokenMatchOffsets[tokenId] = first;
+    matchState.tokenMatchSizes[tokenId] = matches.size() - first;
+    memcpy(freqCount, freqCount + queryGramCount, queryGramCount * sizeof(int16_t));
+}
+
+/**
+ * size in bytes of the three arrays of a gram index
+ */
+inline uint32_t gramIndexBytes(const GramIndex& index) {
+    return index.size * sizeof(Gram) + (index.size + 1) * sizeof(int) + index.offsets[index.size] * sizeof(Posting);
+}
+
+template <typename T>
+inline size_t capacityBytes(const vector<T>& vec) {
+    return vec.capacity() * sizeof(T);
+}
+
+/**
+ * account for the memory of a searcher after an operation that may have changed it.
+ * Hash maps and the shared dictionary are not counted
+ */
+void syncMemory(FastSearcher* searcher) {
+    int64_t index = searcher->arena ? searcher->layout.size : 0;
+    for (const auto& gramIndex : searcher->gramIndices) {
+        if (gramIndex.grams) index += gramIndexBytes(gramIndex);
+    }
+    const auto& typoIndex = searcher->typoIndex;
+    if (typoIndex.mem) index += (typoIndex.size * 2 + 1 + typoIndex.offsets[typoIndex.size]) * sizeof(int);
+    if (searcher->suffixIndex.mem) index += searcher->suffixIndex.size * 2 * sizeof(int);
+    if (const auto* mut = searcher->mut) {
+        index += capacityBytes(mut->text) + capacityBytes(mut->sentences) + capacityBytes(mut->tokenIds) + capacityBytes(mut->tokenPositions) +
+                 capacityBytes(mut->uniqueTokens) + capacityBytes(mut->postingHeads) + capacityBytes(mut->postings);
+    }
+
+    const auto& context = searcher->context;
+    const auto& state = context.state;
+    const auto& matchState = context.matchState;
+    int64_t query = (searcher->numDocs + searcher->maxTokenLen * searcher->numThreads) * sizeof(int);
+    query += capacityBytes(state.intersections) + capacityBytes(state.tokenScores) + capacityBytes(state.sentenceScores) +
+             capacityBytes(state.matchedTokens) + capacityBytes(state.tokenWords) + capacityBytes(state.typoTokens) +
+             capacityBytes(state.isTypoToken) + capacityBytes(state.candidates) + capacityBytes(state.isCandidate) +
+             capacityBytes(state.docScores) + capacityBytes(state.docCandidates) + capacityBytes(state.isDocCandidate);
+    query += capacityBytes(matchState.tokenQuery) + capacityBytes(matchState.tokenMatchOffsets) + capacityBytes(matchState.tokenMatchSizes) +
+             capacityBytes(matchState.tokenMatches) + capacityBytes(matchState.resultOffsets) + capacityBytes(matchState.resultMatches) +
+             capacityBytes(matchState.packedResults);
+
+    const int64_t bytes[] = {index, query, static_cast<int64_t>(searcher->cache.bytes)};
+    const MemoryCategory categories[] = {MEMORY_SEARCH_INDEX, MEMORY_SEARCH_QUERY, MEMORY_SEARCH_CACHE};
+    for (int i = 0; i < 3; i++) {
+        Memory::track(categories[i], bytes[i] - searcher->memory[i]);
+        searcher->memory[i] = bytes[i];
+    }
+}
+
+/**
+ * @returns the rank of the document in the results of the last query, or -1 if it is not in the results
+ */
+inline int findResult(const FastSearcher* searcher, int idx) {
+    for (int i = 0; i < searcher->context.numResults; i++)
+        if (searcher->context.indices[i] == idx) return i;
+    return -1;
+}
+
+/**
+ * point the arrays of the searcher to the modified index
+ */
+void bindMutable(FastSearcher* searcher) {
+    auto& mut = *searcher->mut;
+    searcher->text = mut.text.data();
+    searcher->sentences = mut.sentences.data();
+    searcher->tokenIds = mut.tokenIds.data();
+    searcher->tokenPositions = mut.tokenPositions.data();
+    searcher->uniqueTokens = mut.uniqueTokens.data();
+    searcher->textSize = mut.text.size();
+    searcher->size = mut.sentences.size();
+    searcher->numDocs = searcher->size / searcher->numFields;
+    searcher->numUnique = mut.uniqueTokens.size();
+}
+
+/**
+ * copy the arrays of the index out of the arena, so that they can grow. The postings of the arena are still used
+ */
+void detachIndex(FastSearcher* searcher) {
+    if (searcher->mut) return;
+    auto& mut = *(searcher->mut = new MutableIndex());
+    const int N = searcher->size, numUnique = searcher->numUnique;
+    // the sentences of an arena are stored in order
+    const int numTokens = N == 0 ? 0 : searcher->sentences[N - 1].tokenOffset + searcher->sentences[N - 1].tokenCount;
+    mut.text.assign(searcher->text, searcher->text + searcher->textSize);
+    mut.sentences.assign(searcher->sentences, searcher->sentences + N);
+    mut.tokenIds.assign(searcher->tokenIds, searcher->tokenIds + numTokens);
+    mut.tokenPositions.assign(searcher->tokenPositions, searcher->tokenPositions + numTokens);
+    mut.uniqueTokens.assign(searcher->uniqueTokens, searcher->uniqueTokens + numUnique);
+    mut.str2num.reserve(numUnique);
+    for (int i = 0; i < numUnique; i++) mut.str2num.emplace(getToken(searcher, i), i);
+    mut.postingHeads.resize(numUnique, -1);
+}
+
+/**
+ * append the text and the tokens of a sentence to the modified index.
+ * Tokens that are not in the dictionary yet are appended to it, and to the gram indices that are already built
+ * @param sentence the index of the sentence, recorded in the postings of its tokens
+ * @returns the entry of the sentence
+ */
+SentenceEntry appendSentence(FastSearcher* searcher, string_view text, int sentence) {
+    auto& mut = *searcher->mut;
+    SentenceEntry entry = {static_cast<int>(mut.text.size()), static_cast<int>(text.size()), static_cast<int>(mut.tokenIds.size()), 0};
+    mut.text.insert(mut.text.end(), text.begin(), text.end());
+    mut.text.push_back(0);
+    forEachToken(text, [&](string_view token, int position) {
+        auto [it, inserted] = mut.str2num.try_emplace(string(token), mut.uniqueTokens.size());
+        const int id = it->second;
+        if (inserted) {
+            mut.uniqueTokens.push_back({entry.textOffset + position, static_cast<int>(token.size())});
+            mut.postingHeads.push_back(-1);
+            addTokenGrams(searcher->gramIndices, id, token);
+        }
+        mut.tokenIds.push_back(id);
+        mut.tokenPositions.push_back(position);
+        // the last posting of a token is for this sentence if the token already occurred in it
+        int& head = mut.postingHeads[id];
+        if (head == -1 || mut.postings[head].first != sentence) {
+            mut.postings.push_back({sentence, head});
+            head = mut.postings.size() - 1;
+        }
+    });
+    entry.tokenCount = mut.tokenIds.size() - entry.tokenOffset;
+    searcher->maxTokenLen = max(searcher->maxTokenLen, entry.tokenCount);
+    return entry;
+}
+
+/**
+ * mark the text and the tokens of a sentence as garbage
+ */
+inline void discardSentence(MutableIndex& mut, const SentenceEntry& entry) {
+    mut.garbage += entry.textLength + 1 + entry.tokenCount * 2 * sizeof(int);
+}
+
+/**
+ * rebuild the arena from the current sentences, which drops the garbage and moves all postings into the CSR arrays.
+ * Token ids are reassigned, so everything that refers to tokens is rebuilt or reset
+ */
+void compactIndex(FastSearcher* searcher) {
+    if (!searcher->mut) return;
+    clearResultCache(searcher);
+    vector<string_view> views(searcher->size);
+    for (int i = 0; i < searcher->size; i++) views[i] = getSentence(searcher, i);
+    vector<float> fieldWeights(searcher->fieldWeights, searcher->fieldWeights + searcher->numFields);
+    void* oldArena = searcher->arena;
+    buildIndex(searcher, views, fieldWeights);
+    free(oldArena);
+    delete searcher->mut;
+    searcher->mut = NULL;
+
+    for (auto& index : searcher->gramIndices) {
+        free(index.mem);
+        index = GramIndex();
+    }
+    free(searcher->suffixIndex.mem);
+    searcher->suffixIndex = SuffixIndex();
+    if (searcher->typoIndex.builtDistance > 0) buildTypoIndex(searcher, searcher->typoIndex.builtDistance);
+    searcher->context.state = QueryState();
+    searcher->context.matchState = MatchState();
+    initQueryState(searcher);
+    if (searcher->dict) {
+        // token ids are reassigned
+        searcher->localIds.clear();
+        searcher->numDictTokens = 0;
+        syncDictionary(searcher);
+    }
+}
+
+/**
+ * finish a modification of the index: the state of the last query is reset, because its candidates do not include the new sentences.
+ * The index is compacted if more than half of it is garbage, or if too many postings are in linked lists
+ */
+void commitModification(FastSearcher* searcher) {
+    bindMutable(searcher);
+    clearResultCache(searcher);
+    free(searcher->suffixIndex.mem);
+    searcher->suffixIndex = SuffixIndex();
+
+    const auto& mut = *searcher->mut;
+    const int size = mut.text.size() + mut.tokenIds.size() * 2 * sizeof(int);
+    const int numPostings = searcher->tokenSentOffsets[searcher->numPostedTokens];
+    if (mut.garbage * 2 > size || static_cast<int>(mut.postings.size()) > numPostings / 2 + MIN_COMPACTION_POSTINGS) {
+        compactIndex(searcher);
+    } else {
+        resetQueryState(searcher, 0);
+        initQueryState(searcher);
+        if (searcher->dict) syncDictionary(searcher);
+    }
+    syncMemory(searcher);
+}
+
+/**
+ * normalize the packed sentences and build a searcher from them
+ * @note buffer and offsets are freed before this function returns
+ */
+FastSearcher* buildPacked(char* buffer, const int* offsets, const vector<float>& fieldWeights, int numDocs) {
+    const int N = numDocs * fieldWeights.size();
+    normalize(buffer, buffer + offsets[N]);
+    auto* searcher = new FastSearcher();
+    vector<string_view> views(N);
+    for (int i = 0; i < N; i++)
+        views[i] = {buffer + offsets[i], static_cast<string_view::size_type>(offsets[i + 1] - offsets[i])};
+    buildIndex(searcher, views, fieldWeights);
+    initQueryState(searcher);
+    syncMemory(searcher);
+
+    free(buffer);
+    free((void*)offsets);
+    return searcher;
+}
+
+/**
+ * call f(worker, begin, end) on consecutive chunks of [0, count), on at most searcher->numThreads threads of the pool
+ */
+template <typename F>
+inline void parallelFor(const FastSearcher* searcher, int count, F&& f) {
+    ThreadPool::parallelFor(count, MIN_PARALLEL_WORK, f, searcher->numThreads);
+}
+
+/**
+ * the body of sWSearch, specialized for a gram length known at compile time
+ * @tparam G the gram length, or 0 if it is only known at runtime
+ */
+template <int G>
+int* sWSearchKernel(FastSearcher* searcher, const char* _query, const int numResults, const int runtimeGramLen, const float threshold) {
+    STATS_TIMER(searchNs);
+    Tracer::Span span{Tracer::Phase::search, static_cast<int>(strlen(_query))};
+    const int gramLen = G > 0 ? G : runtimeGramLen;
+    string_view query(_query);
+    auto& words = searcher->context.words;
+    words.resize(0);
+    split(_query, words);
+
+    const int maxWindow = max((int)words.size(), 2);
+    const int queryGramCount = max(static_cast<int>(query.size()) - gramLen + 1, 0);
+    auto& state = searcher->context.state;
+    auto& tokenScores = state.tokenScores;
+    auto& tokenWords = state.tokenWords;
+    // the index of the query word that the character at the given offset belongs to (or follows, if it is a space)
+    auto wordAt = [_query, &words](int offset) {
+        auto it = upper_bound(words.begin(), words.end(), _query + offset, [](const char* p, string_view w) { return p < w.data(); });
+        return max(static_cast<int>(it - words.begin()) - 1, 0);
+    };
+    auto& sentenceScores = state.sentenceScores;
+
+    if (gramLen <= MAX_INT_GRAM_LEN && searcher->dict) {
+        // the tokens are matched once by the shared dictionary, then mapped to the tokens of this searcher
+        auto& dict = *searcher->dict;
+        matchDictionary(dict, query, gramLen, wordAt);
+        if (state.gramLen != gramLen || state.dictGeneration != dict.generation || query.substr(0, state.query.size()) != state.query)
+            resetQueryState(searcher, gramLen);
+        state.dictGeneration = dict.generation;
+        const auto& localIds = searcher->localIds;
+        const auto& dictMatched = dict.state.matchedTokens;
+        const int numDictMatched = dictMatched.size(), numLocalIds = localIds.size();
+        for (int k = 0; k < numDictMatched; k++) {
+            const int id = dictMatched[k];
+            const int i = id < numLocalIds ? localIds[id] : -1;
+            if (i == -1) continue;
+            // intersections of tokens matched before may have grown
+            state.intersections[i] = dict.state.intersections[id];
+            tokenWords[i] = dict.state.tokenWords[id];
+            if (k >= state.dictMatched) addMatchedToken(searcher, i);
+        }
+        state.dictMatched = numDictMatched;
+        state.query = query;
+    } else if (gramLen <= MAX_INT_GRAM_LEN) {
+        const auto& index = getGramIndex(searcher, gramLen);
+        int from = 0;
+        if (state.gramLen == gramLen && query.substr(0, state.query.size()) == state.query) {
+            from = max(static_cast<int>(state.query.size()) - gramLen + 1, 0);
+        } else {
+            resetQueryState(searcher, gramLen);
+        }
+        for (int j = from; j < queryGramCount; j++)
+            addQueryGram(state, index, gramAt(_query + j, gramLen), wordAt(j), [searcher](int token) { addMatchedToken(searcher, token); });
+        state.query = query;
+    } else {
+        // grams too long to be packed: compute the intersection of every token from scratch
+        resetQueryState(searcher, 0);
+        GramMap queryGrams;
+        auto [freqCount, _] = constructQueryGrams(queryGrams, query, gramLen);
+        for (int i = 0; i < searcher->numUnique; i++) {
+            auto token = getToken(searcher, i);
+            const int tokenGramCount = static_cast<int>(token.size()) - gramLen + 1;
+
+            int intersectionSize = 0;
+            size_t firstGram = string_view::npos;
+            for (int j = 0; j < tokenGramCount; j++) {
+                auto it = queryGrams.find(token.substr(j, gramLen));
+                if (it != queryGrams.end() && *(it->second) > 0) {
+                    *it->second -= 1;  // decrement the frequency (don't want this gram to be matched again)
+                    intersectionSize++;
+                    firstGram = min(firstGram, query.find(token.substr(j, gramLen)));
+                }
+            }
+            if (intersectionSize > 0) {
+                state.intersections[i] = intersectionSize;
+                tokenWords[i] = wordAt(firstGram);
+                addMatchedToken(searcher, i);
+                // restore frequency table to its original state
+                memcpy(freqCount, freqCount + queryGramCount, queryGramCount * sizeof(int16_t));
+            }
+        }
+        delete[] freqCount;
+    }
+
+    // typo matches depend on the whole query, so they are recomputed for every query
+    for (int i : state.typoTokens) {
+        state.isTypoToken[i] = 0;
+        tokenScores[i] = 0.0f;
+        if (state.intersections[i] == 0) tokenWords[i] = -1;
+    }
+    state.typoTokens.resize(0);
+
+    // compute score for each matched token. The other tokens have a score of 0
+    searcher->context.queryId++;
+    STATS_ADD(tokensScored, state.matchedTokens.size());
+    parallelFor(searcher, state.matchedTokens.size(), [&](int, int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            const int i = state.matchedTokens[k];
+            const int tokenGramCount = searcher->uniqueTokens[i].length - gramLen + 1;
+            // intersection over union
+            tokenScores[i] = (2.0f * state.intersections[i]) / (queryGramCount + tokenGramCount);
+        }
+    });
+    if (searcher->typoIndex.maxDistance > 0) addTypoMatches(searcher, words, queryGramCount, gramLen);
+
+    // compute score for each candidate sentence. The other sentences have a score of 0
+    // each worker scores a chunk of the candidates, using its own score window
+    STATS_ADD(sentencesScored, state.candidates.size());
+    parallelFor(searcher, state.candidates.size(), [&](int worker, int begin, int end) {
+        float* scoreWindow = searcher->context.scoreWindow + worker * searcher->maxTokenLen;
+        for (int k = begin; k < end; k++) {
+            const int i = state.candidates[k];
+            const auto& sentence = searcher->sentences[i];
+            const int* tokens = searcher->tokenIds + sentence.tokenOffset;
+            const int tokenLen = sentence.tokenCount;
+
+            // use the number of words as the window size in this string if maxWindow > number of words
+            const int window = min(maxWindow, tokenLen);
+
+            // the phrase bonus of the pair of tokens (j - 1, j). It only counts while both tokens are in the window
+            auto pairBonus = [&](int j) {
+                const int word = tokenWords[tokens[j]], prevWord = tokenWords[tokens[j - 1]];
+                if (prevWord == -1 || word != prevWord + 1) return 0.0f;
+                return PHRASE_BONUS * min(tokenScores[tokens[j]], tokenScores[tokens[j - 1]]);
+            };
+
+            float score = 0, maxScore = 0;
+            // initialize score window
+            for (int j = 0; j < window; j++) {
+                score += scoreWindow[j] = tokenScores[tokens[j]];
+                if (j > 0) score += pairBonus(j);
+            }
+            if (score > maxScore) maxScore = score;
+
+            for (int j = window; j < tokenLen; j++) {
+                // subtract the last score and the bonus of the pair that it starts, and add the new score and the bonus of the pair that it ends
+                score -= scoreWindow[j - window];
+                if (window > 1) score -= pairBonus(j - window + 1);
+                float tokenScore = tokenScores[tokens[j]];
+                score += scoreWindow[j] = tokenScore;
+                if (window > 1) score += pairBonus(j);
+
+                if (tokenScore < threshold) continue;
+                if (score > maxScore) maxScore = score;
+            }
+            sentenceScores[i] = maxScore;
+        }
+    });
+
+    // with a single field, a document is a sentence
+    const int numFields = searcher->numFields;
+    if (numFields > 1) computeDocScores(searcher);
+    const auto& docScores = numFields > 1 ? state.docScores : sentenceScores;
+    const auto& candidates = numFields > 1 ? state.docCandidates : state.candidates;
+    const auto& isCandidate = numFields > 1 ? state.isDocCandidate : state.isCandidate;
+
+    // rank the candidates, then pad the results with non-candidates if there are not enough of them
+    const int len = searcher->numDocs;
+    const int numCandidates = candidates.size();
+    const int total = min(numResults, len);
+    auto* indices = searcher->context.indices;
+    copy(candidates.begin(), candidates.end(), indices);
+    auto cmp = [&docScores](int a, int b) {
+        return docScores[b] < docScores[a];
+    };
+    if (numCandidates > numResults) {
+        std::partial_sort(indices, indices + numResults, indices + numCandidates, cmp);
+    } else {
+        std::sort(indices, indices + numCandidates, cmp);
+        for (int i = 0, j = numCandidates; j < total; i++) {
+            if (!isCandidate[i]) indices[j++] = i;
+        }
+    }
+    searcher->context.numResults = total;
+
+    // compute matches for the selected sentences only
+    auto& matchState = searcher->context.matchState;
+    auto& resultMatches = matchState.resultMatches;
+    matchState.tokenMatches.resize(0);
+    resultMatches.resize(0);
+    matchState.resultOffsets.resize(total * numFields + 1);
+    GramMap queryGrams;
+    vector<Gram> intQueryGrams;
+    int16_t* freqCount;
+    if constexpr (G > 0) {
+        freqCount = constructIntQueryGrams(intQueryGrams, query, gramLen).first;
+    } else {
+        freqCount = constructQueryGrams(queryGrams, query, gramLen).first;
+    }
+    auto findGram = [&](const char* gram) -> int16_t* {
+        if constexpr (G > 0) {
+            const Gram key = gramAt(gram, gramLen);
+            const int idx = findIntGram(intQueryGrams, key);
+            return idx >= 0 ? freqCount + idx : nullptr;
+        } else {
+            auto it = queryGrams.find(string_view(gram, gramLen));
+            return it != queryGrams.end() ? it->second : nullptr;
+        }
+    };
+    for (int i = 0; i < total * numFields; i++) {
+        const auto& sentence = searcher->sentences[indices[i / numFields] * numFields + i % numFields];
+        const int first = matchState.resultOffsets[i] = resultMatches.size();
+        for (int j = sentence.tokenOffset, end = j + sentence.tokenCount; j < end; j++) {
+            int token = searcher->tokenIds[j];
+            if (tokenScores[token] < threshold) continue;
+            if (matchState.tokenQuery[token] != searcher->context.queryId)
+                computeTokenMatches(searcher, token, findGram, freqCount, queryGramCount, gramLen);
+            // add token matches to sentence matches
+            int position = searcher->tokenPositions[j];
+            const auto* tokenMatches = matchState.tokenMatches.data() + matchState.tokenMatchOffsets[token];
+            for (int k = 0; k < matchState.tokenMatchSizes[token]; k++)
+                addMatchNoOverlap(resultMatches, first, position + tokenMatches[k].start, position + tokenMatches[k].end);
+        }
+    }
+    matchState.resultOffsets[total * numFields] = resultMatches.size();
+    delete[] freqCount;
+    free((void*)_query);
+    return indices;
+}
+
+/**
+ * check that an image of `length` bytes can be used in place: its header, the bounds of its arrays,
+ * and the indices stored in them. Images are shipped with the app, so a truncated or stale one must be rejected
+ */
+bool validImage(const char* image, uint32_t length) {
+    if (length < sizeof(ImageHeader)) return false;
+    const auto* header = reinterpret_cast<const ImageHeader*>(image);
+    if (header->magic != IMAGE_MAGIC || header->version != IMAGE_VERSION || header->size != length) return false;
+    const int N = header->numSentences, numFields = header->numFields, numUnique = header->numUnique;
+    if (N < 0 || numFields <= 0 || N % numFields != 0 || numUnique < 0 || header->maxTokenLen < 0) return false;
+
+    // an array of count elements of type T at offset, which must end before `end`
+    auto fits = [](uint32_t offset, uint32_t end, int64_t count, size_t elemSize, size_t alignment) {
+        return offset % alignment == 0 && offset <= end && count >= 0 && count * elemSize <= end - offset;
+    };
+    // the arrays of the arena are laid out in this order, see buildIndex. The end of each is bounded by the start of the next
+    const auto& layout = header->layout;
+    const uint64_t arenaEnd = static_cast<uint64_t>(layout.text) + layout.size;
+    const uint32_t bounds[] = {layout.text, layout.sentences, layout.tokenIds, layout.tokenPositions, layout.uniqueTokens,
+                               layout.tokenSentOffsets, layout.tokenSentences, layout.fieldWeights};
+    if (arenaEnd > length || !is_sorted(begin(bounds), end(bounds)) || layout.fieldWeights > arenaEnd) return false;
+    const int64_t textSize = layout.sentences - layout.text;
+    const int64_t numTokens = (layout.tokenPositions - layout.tokenIds) / sizeof(int);
+    if (!fits(layout.sentences, layout.tokenIds, N, sizeof(SentenceEntry), alignof(SentenceEntry)) ||
+        !fits(layout.tokenIds, layout.tokenPositions, numTokens, sizeof(int), alignof(int)) ||
+        !fits(layout.tokenPositions, layout.uniqueTokens, numTokens, sizeof(int), alignof(int)) ||
+        !fits(layout.uniqueTokens, layout.tokenSentOffsets, numUnique, sizeof(TokenEntry), alignof(TokenEntry)) ||
+        !fits(layout.tokenSentOffsets, layout.tokenSentences, numUnique + 1LL, sizeof(int), alignof(int)) ||
+        !fits(layout.fieldWeights, arenaEnd, numFields, sizeof(float), alignof(float)))
+        return false;
+
+    const auto* sentences = reinterpret_cast<const SentenceEntry*>(image + layout.sentences);
+    const auto* tokenIds = reinterpret_cast<const int*>(image + layout.tokenIds);
+    const auto* tokenPositions = reinterpret_cast<const int*>(image + layout.tokenPositions);
+    for (int i = 0; i < N; i++) {
+        const auto& sentence = sentences[i];
+        // the text of each sentence is followed by a NULL character
+        if (sentence.textOffset < 0 || sentence.textLength < 0 ||
+            static_cast<int64_t>(sentence.textOffset) + sentence.textLength >= textSize || sentence.tokenOffset < 0 ||
+            sentence.tokenCount < 0 || sentence.tokenCount > header->maxTokenLen ||
+            static_cast<int64_t>(sentence.tokenOffset) + sentence.tokenCount > numTokens)
+            return false;
+        for (int j = sentence.tokenOffset; j < sentence.tokenOffset + sentence.tokenCount; j++) {
+            if (tokenIds[j] < 0 || tokenIds[j] >= numUnique) return false;
+            if (tokenPositions[j] < 0 || tokenPositions[j] > sentence.textLength) return false;
+        }
+    }
+    const auto* uniqueTokens = reinterpret_cast<const TokenEntry*>(image + layout.uniqueTokens);
+    for (int i = 0; i < numUnique; i++) {
+        const auto& token = uniqueTokens[i];
+        if (token.offset < 0 || token.length < 0 || static_cast<int64_t>(token.offset) + token.length > textSize) return false;
+    }
+    const auto* tokenSentOffsets = reinterpret_cast<const int*>(image + layout.tokenSentOffsets);
+    if (tokenSentOffsets[0] != 0) return false;
+    for (int i = 0; i < numUnique; i++)
+        if (tokenSentOffsets[i + 1] < tokenSentOffsets[i]) return false;
+    if (!fits(layout.tokenSentences, layout.fieldWeights, tokenSentOffsets[numUnique], sizeof(int), alignof(int))) return false;
+    const auto* tokenSentences = reinterpret_cast<const int*>(image + layout.tokenSentences);
+    for (int i = 0; i < tokenSentOffsets[numUnique]; i++)
+        if (tokenSentences[i] < 0 || tokenSentences[i] >= N) return false;
+
+    for (int i = 2; i <= MAX_INT_GRAM_LEN; i++) {
+        const auto& indexLayout = header->gramIndices[i];
+        if (indexLayout.size < 0) return false;
+        if (indexLayout.size == 0) continue;
+        if (!fits(indexLayout.grams, length, indexLayout.size, sizeof(Gram), alignof(Gram)) ||
+            !fits(indexLayout.offsets, length, indexLayout.size + 1LL, sizeof(int), alignof(int)))
+            return false;
+        const auto* offsets = reinterpret_cast<const int*>(image + indexLayout.offsets);
+        if (offsets[0] != 0) return false;
+        for (int j = 0; j < indexLayout.size; j++)
+            if (offsets[j + 1] < offsets[j]) return false;
+        if (!fits(indexLayout.postings, length, offsets[indexLayout.size], sizeof(Posting), alignof(Posting))) return false;
+        const auto* postings = reinterpret_cast<const Posting*>(image + indexLayout.postings);
+        for (int j = 0; j < offsets[indexLayout.size]; j++)
+            if (postings[j].token < 0 || postings[j].token >= numUnique) return false;
+    }
+    return true;
+}
+
+extern "C" {
+
+/**
+ * get a FastSearcher instance pointer
+ * @param sentences an array of NULL-terminated strings. They should be .trim(), .toLowerCase(), and probably with puncturations stripped beforehand
+ * @param N ths length of sentences
+ * @note the strings and the array will be freed before this function returns
+*/
+FastSearcher* getSearcher(const char** sentences, int N) {
+    if (Capture::Record rec{Capture::Call::getSearcher}) {
+        rec << N;
+        for (int i = 0; i < N; i++) rec << Capture::str(sentences[i]);
+    }
+    auto* searcher = new FastSearcher();
+    vector<string_view> views(N);
+    for (int i = 0; i < N; i++) views[i] = sentences[i];
+    buildIndex(searcher, views, {1.0f});
+    initQueryState(searcher);
+    syncMemory(searcher);
+
+    for (int i = 0; i < N; i++) free((void*)sentences[i]);
+    free((void*)sentences);
+    Capture::recordResult(searcher);
+    return searcher;
+}
+
+/**
+ * get a FastSearcher instance pointer from sentences packed in a single buffer.
+ * The sentences are normalized in one pass before they are indexed: see `normalize`
+ * @param buffer the UTF-8 encoded sentences, concatenated. It does not need to be trimmed or lower-cased
+ * @param offsets sentence i is buffer[offsets[i]] to buffer[offsets[i + 1]]. Length = N + 1
+ * @param N the number of sentences
+ * @note buffer and offsets will be freed before this function returns
+*/
+FastSearcher* getSearcherPacked(char* buffer, const int* offsets, int N) {
+    if (Capture::Record rec{Capture::Call::getSearcherPacked})
+        rec << Capture::bytes(buffer, offsets[N]) << Capture::bytes(offsets, N + 1) << N;
+    auto* searcher = buildPacked(buffer, offsets, {1.0f}, N);
+    Capture::recordResult(searcher);
+    return searcher;
+}
+
+/**
+ * get a FastSearcher instance pointer that indexes several fields of each document.
+ * `sWSearch` ranks the documents by the weighted sum of the scores of their fields, and the matches of each field are available separately
+ * @param buffer the fields of all documents, packed in the same way as in `getSearcherPacked`
+ * @param offsets field f of document i is buffer[offsets[k]] to buffer[offsets[k + 1]], k = i * numFields + f. Length = numDocs * numFields + 1
+ * @param numDocs the number of documents
+ * @param weights the weight of each field. Length = numFields
+ * @param numFields the number of fields of each document
+ * @note buffer, offsets and weights will be freed before this function returns
+ */
+FastSearcher* getMultiFieldSearcher(char* buffer, const int* offsets, int numDocs, const float* weights, int numFields) {
+    if (Capture::Record rec{Capture::Call::getMultiFieldSearcher}) {
+        const int numSentences = numDocs * numFields;
+        rec << Capture::bytes(buffer, offsets[numSentences]) << Capture::bytes(offsets, numSentences + 1) << numDocs
+            << Capture::bytes(weights, numFields) << numFields;
+    }
+    vector<float> fieldWeights(weights, weights + numFields);
+    free((void*)weights);
+    auto* searcher = buildPacked(buffer, offsets, fieldWeights, numDocs);
+    Capture::recordResult(searcher);
+    return searcher;
+}
+
+/**
+ * Adapted from [[https://github.com/aceakash/string-similarity]], with optimizations
+ * MIT License
+ * @param _query a dynamically allocated string. It will be freed before this function returns.
+ * @returns the index of the document whose field matches the query best
+ */
+int findBestMatch(FastSearcher* searcher, const char* _query) {
+    if (Capture::Record rec{Capture::Call::findBestMatch}) rec << Capture::Handle{searcher} << Capture::str(_query);
+    string_view query(_query);
+    GramMap queryGrams;
+    auto [freqCount, queryGramCount] = constructQueryGrams(queryGrams, query, 2);
+
+    float bestMatchRating = 0.0f;
+    int bestMatchIndex = 0;
+    for (int i = 0; i < searcher->size; i++) {
+        float currentRating = compareTwoStrings(queryGrams, query, getSentence(searcher, i));
+        if (currentRating > bestMatchRating) {
+            bestMatchIndex = i;
+            bestMatchRating = currentRating;
+        }
+        memcpy(freqCount, freqCount + queryGramCount, queryGramCount * sizeof(int16_t));
+    }
+    // the score of the best match is written to the sentence, so it must be recorded as a candidate to be cleared by the next search
+    resetQueryState(searcher, 0);
+    searcher->context.state.isCandidate[bestMatchIndex] = 1;
+    searcher->context.state.candidates.push_back(bestMatchIndex);
+    searcher->context.state.sentenceScores[bestMatchIndex] = bestMatchRating;
+    if (searcher->numFields > 1) computeDocScores(searcher);
+    free((void*)_query);
+    delete[] freqCount;
+    syncMemory(searcher);
+    return bestMatchIndex / searcher->numFields;
+}
+
+/**
+ * sliding window search
+ *
+ * Scores are computed for all tokens and sentences first. Matches are only computed afterwards for the top `numResults` documents,
+ * because the matches of the other sentences are never read
+ *
+ * If the query extends the last query (e.g. when the user is typing), only the grams that are appended are processed
+ * and only the candidate sentences are scored
+ *
+ * Two adjacent tokens that match consecutive query words, in the same order as in the query,
+ * add PHRASE_BONUS times the smaller of their scores to a window that contains both, so that phrases rank above scattered words
+ *
+ * If the searcher has several fields, the documents are ranked by the weighted sum of the scores of their fields
+ *
+ * The results of recent queries are cached until the index is modified. A repeated query only copies its results from the cache,
+ * in which case the documents that are not in the results have a score of 0
+ * @returns the indices of the documents, in descending order of score
+ * @param _query a dynamically allocated string. It will be freed after this function returns.
+*/
+int* sWSearch(FastSearcher* searcher, const char* _query, const int numResults, const int gramLen, const float threshold) {
+    if (Capture::Record rec{Capture::Call::sWSearch})
+        rec << Capture::Handle{searcher} << Capture::str(_query) << numResults << gramLen << threshold;
+    // repeated queries, e.g. when the user deletes the last characters of the query, are restored from the cache
+    const auto key = resultCacheKey(_query, numResults, gramLen, threshold);
+    if (restoreCachedResult(searcher, key)) {
+        free((void*)_query);
+        syncMemory(searcher);
+        return searcher->context.indices;
+    }
+
+    // dispatch once to a kernel specialized for the gram length, so that the gram loops in it are unrolled
+    int* indices;
+    switch (gramLen) {
+        case 2: indices = sWSearchKernel<2>(searcher, _query, numResults, gramLen, threshold); break;
+        case 3: indices = sWSearchKernel<3>(searcher, _query, numResults, gramLen, threshold); break;
+        default: indices = sWSearchKernel<0>(searcher, _query, numResults, gramLen, threshold);
+    }
+    cacheResult(searcher, key);
+    syncMemory(searcher);
+    return indices;
+}
+
+/**
+ * exact substring search, using the suffix array of the text. The suffix array is built on the first call,
+ * and the index is compacted first if it has been modified
+ *
+ * A field scores 1 if it contains the query, so documents are ranked by the sum of the weights of their fields that contain the query,
+ * then by index. The matches are the occurrences of the query. Unlike `sWSearch`, the results are not padded
+ * @param _query a dynamically allocated string. It will be freed before this function returns.
+ * @param maxResults the maximum number of documents to return
+ * @param prefixOnly if nonzero, only occurrences at the start of a token are matched, e.g. "21" matches "2150" but not "cs 1210"
+ * @returns the indices of the matched documents. Their number is given by `getNumResults`
+ */
+int* substringSearch(FastSearcher* searcher, const char* _query, int maxResults, int prefixOnly) {
+    if (Capture::Record rec{Capture::Call::substringSearch})
+        rec << Capture::Handle{searcher} << Capture::str(_query) << maxResults << prefixOnly;
+    string_view query(_query);
+    // occurrences are mapped to sentences by their offsets in the text, which requires the sentences to be stored in order
+    compactIndex(searcher);
+    const auto& index = getSuffixIndex(searcher);
+    // an empty query would match every position
+    auto [begin, end] = query.empty() ? make_pair(0, 0) : findSuffixRange(searcher, index, query);
+
+    // find the sentence of each occurrence. Sorting by position also sorts by sentence
+    vector<int> positions;
+    for (int i = begin; i < end; i++) {
+        int pos = index.suffixes[i];
+        if (prefixOnly && pos > 0 && searcher->text[pos - 1] != ' ' && searcher->text[pos - 1] != 0) continue;
+        positions.push_back(pos);
+    }
+    sort(positions.begin(), positions.end());
+    // occurrences[i] = {sentence, position in the sentence}
+    vector<pair<int, int>> occurrences;
+    occurrences.reserve(positions.size());
+    const auto* sentences = searcher->sentences;
+    for (int pos : positions) {
+        int sentence = upper_bound(sentences, sentences + searcher->size, pos,
+                                   [](int p, const SentenceEntry& entry) { return p < entry.textOffset; }) -
+                       sentences - 1;
+        occurrences.push_back({sentence, pos - sentences[sentence].textOffset});
+    }
+
+    // score the sentences, and the documents if there are several fields
+    resetQueryState(searcher, 0);
+    auto& state = searcher->context.state;
+    for (int i = 0; i < static_cast<int>(occurrences.size()); i++) {
+        int sentence = occurrences[i].first;
+        if (i > 0 && sentence == occurrences[i - 1].first) continue;
+        state.isCandidate[sentence] = 1;
+        state.candidates.push_back(sentence);
+        state.sentenceScores[sentence] = 1.0f;
+    }
+    const int numFields = searcher->numFields;
+    if (numFields > 1) computeDocScores(searcher);
+    const auto& docScores = numFields > 1 ? state.docScores : state.sentenceScores;
+    const auto& candidates = numFields > 1 ? state.docCandidates : state.candidates;
+
+    // candidates are in ascending order of index, so a stable sort ranks the documents with the same score by index
+    const int numCandidates = candidates.size();
+    const int total = min(maxResults, numCandidates);
+    auto* indices = searcher->context.indices;
+    copy(candidates.begin(), candidates.end(), indices);
+    stable_sort(indices, indices + numCandidates, [&docScores](int a, int b) { return docScores[b] < docScores[a]; });
+    searcher->context.numResults = total;
+
+    auto& matchState = searcher->context.matchState;
+    auto& resultMatches = matchState.resultMatches;
+    resultMatches.resize(0);
+    matchState.resultOffsets.resize(total * numFields + 1);
+    for (int i = 0; i < total * numFields; i++) {
+        const int sentence = indices[i / numFields] * numFields + i % numFields;
+        const int first = matchState.resultOffsets[i] = resultMatches.size();
+        auto it = lower_bound(occurrences.begin(), occurrences.end(), make_pair(sentence, 0));
+        for (; it != occurrences.end() && it->first == sentence; it++)
+            addMatchNoOverlap(resultMatches, first, it->second, it->second + static_cast<int>(query.size()));
+    }
+    matchState.resultOffsets[total * numFields] = resultMatches.size();
+    free((void*)_query);
+    syncMemory(searcher);
+    return indices;
+}
+
+/**
+ * @returns the number of results of the last query
+ */
+int getNumResults(const FastSearcher* searcher) {
+    return searcher->context.numResults;
+}
+
+/**
+ * @note only the matches of the documents returned by the last query are available
+ */
+const Match* getFieldMatches(const FastSearcher* searcher, int idx, int field) {
+    int rank = findResult(searcher, idx);
+    const auto& matchState = searcher->context.matchState;
+    return matchState.resultMatches.data() + (rank == -1 ? 0 : matchState.resultOffsets[rank * searcher->numFields + field]);
+}
+int getFieldMatchSize(const FastSearcher* searcher, int idx, int field) {
+    int rank = findResult(searcher, idx);
+    if (rank == -1) return 0;
+    const auto& matchState = searcher->context.matchState;
+    const int k = rank * searcher->numFields + field;
+    return matchState.resultOffsets[k + 1] - matchState.resultOffsets[k];
+}
+/**
+ * @returns the (unweighted) score of a field of a document
+ */
+float getFieldScore(const FastSearcher* searcher, int idx, int field) {
+    return searcher->context.state.sentenceScores[idx * searcher->numFields + field];
+}
+
+const Match* getMatches(const FastSearcher* searcher, int idx) {
+    return getFieldMatches(searcher, idx, 0);
+}
+int getMatchSize(const FastSearcher* searcher, int idx) {
+    return getFieldMatchSize(searcher, idx, 0);
+}
+float getScore(const FastSearcher* searcher, int idx) {
+    return searcher->numFields > 1 ? searcher->context.state.docScores[idx] : searcher->context.state.sentenceScores[idx];
+}
+
+/**
+ * pack the results of the last query into a single buffer, so that they can be read at once instead of with several calls per result.
+ * The layout, in 32-bit words, is the number of results followed by, for each result:
+ * its index, its score (a float), and for each field: the score of the field (a float), the number of matches n, and n (start, end) pairs
+ * @note the buffer is owned by the searcher, and is overwritten by the next call
+ */
+const int32_t* getResultsPacked(FastSearcher* searcher) {
+    const int numFields = searcher->numFields;
+    const auto& matchState = searcher->context.matchState;
+    auto& buffer = searcher->context.matchState.packedResults;
+    auto pushFloat = [&buffer](float value) {
+        int32_t word;
+        memcpy(&word, &value, sizeof(float));
+        buffer.push_back(word);
+    };
+    buffer.resize(0);
+    buffer.push_back(searcher->context.numResults);
+    for (int i = 0; i < searcher->context.numResults; i++) {
+        const int idx = searcher->context.indices[i];
+        buffer.push_back(idx);
+        pushFloat(getScore(searcher, idx));
+        for (int f = 0; f < numFields; f++) {
+            const int k = i * numFields + f;
+            pushFloat(searcher->context.state.sentenceScores[idx * numFields + f]);
+            buffer.push_back(matchState.resultOffsets[k + 1] - matchState.resultOffsets[k]);
+            for (int j = matchState.resultOffsets[k]; j < matchState.resultOffsets[k + 1]; j++) {
+                buffer.push_back(matchState.resultMatches[j].start);
+                buffer.push_back(matchState.resultMatches[j].end);
+            }
+        }
+    }
+    return buffer.data();
+}
+
+/**
+ * write the index of the searcher (text, tokens and the gram postings for gram lengths 2 and 3) into a versioned binary image,
+ * which can be loaded by `loadSearcher` without rebuilding the index.
+ * A searcher attached to a dictionary does not keep gram indices: they are built for the image, and freed afterwards
+ * @returns a dynamically allocated buffer, whose size is stored in its header (the third uint32). The caller should free it
+ */
+void* serializeSearcher(FastSearcher* searcher) {
+    // the image is a copy of the arena
+    compactIndex(searcher);
+    const bool temporary = searcher->dict != nullptr;
+    getGramIndex(searcher, 2);
+    getGramIndex(searcher, 3);
+
+    ImageHeader header = {};
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.numSentences = searcher->size;
+    header.numFields = searcher->numFields;
+    header.numUnique = searcher->numUnique;
+    header.maxTokenLen = searcher->maxTokenLen;
+
+    // the arena is copied as a whole, so all of its offsets are shifted by the same amount
+    uint32_t size = sizeof(ImageHeader);
+    const uint32_t arenaOffset = reserveArray<max_align_t>(size, 0);
+    size += searcher->layout.size;
+    const auto& layout = searcher->layout;
+    header.layout = {
+        arenaOffset + layout.text,
+        arenaOffset + layout.sentences,
+        arenaOffset + layout.tokenIds,
+        arenaOffset + layout.tokenPositions,
+        arenaOffset + layout.uniqueTokens,
+        arenaOffset + layout.tokenSentOffsets,
+        arenaOffset + layout.tokenSentences,
+        arenaOffset + layout.fieldWeights,
+        layout.size};
+    for (int i = 2; i <= MAX_INT_GRAM_LEN; i++) {
+        const auto& index = searcher->gramIndices[i];
+        if (index.gramLen != i) continue;
+        auto& indexLayout = header.gramIndices[i];
+        indexLayout.size = index.size;
+        indexLayout.grams = reserveArray<Gram>(size, index.size);
+        indexLayout.offsets = reserveArray<int>(size, index.size + 1);
+        indexLayout.postings = reserveArray<Posting>(size, index.offsets[index.size]);
+    }
+    header.size = size;
+
+    auto* image = static_cast<char*>(calloc(size, 1));
+    memcpy(image, &header, sizeof(ImageHeader));
+    memcpy(image + arenaOffset, searcher->arena, layout.size);
+    for (int i = 2; i <= MAX_INT_GRAM_LEN; i++) {
+        const auto& index = searcher->gramIndices[i];
+        if (index.gramLen != i) continue;
+        const auto& indexLayout = header.gramIndices[i];
+        memcpy(image + indexLayout.grams, index.grams, index.size * sizeof(Gram));
+        memcpy(image + indexLayout.offsets, index.offsets, (index.size + 1) * sizeof(int));
+        memcpy(image + indexLayout.postings, index.postings, index.offsets[index.size] * sizeof(Posting));
+    }
+    if (temporary) {
+        for (auto& index : searcher->gramIndices) {
+            free(index.mem);
+            index = GramIndex();
+        }
+    }
+    syncMemory(searcher);
+    return image;
+}
+
+/**
+ * get a FastSearcher instance from an image produced by `serializeSearcher`.
+ * The index is used in place: only the pointers into the image are set up, nothing is copied
+ * @param image a dynamically allocated buffer containing the image. The searcher takes ownership of it, and frees it when it is deleted
+ * @param length the size of the buffer in bytes
+ * @returns NULL if the image is invalid, truncated or was produced by an incompatible version. In this case, the image is freed
+ */
+FastSearcher* loadSearcher(void* image, int length) {
+    if (length < 0 || !validImage(static_cast<const char*>(image), length)) {
+        free(image);
+        return NULL;
+    }
+    const auto* header = static_cast<const ImageHeader*>(image);
+    auto* searcher = new FastSearcher();
+    searcher->size = header->numSentences;
+    searcher->numFields = header->numFields;
+    searcher->numDocs = header->numSentences / header->numFields;
+    searcher->numUnique = header->numUnique;
+    searcher->maxTokenLen = header->maxTokenLen;
+    searcher->layout = header->layout;
+    searcher->numPostedTokens = header->numUnique;
+    bindArena(searcher, image);
+    if (searcher->size > 0) {
+        const auto& last = searcher->sentences[searcher->size - 1];
+        searcher->textSize = last.textOffset + last.textLength + 1;
+    }
+
+    auto* base = static_cast<char*>(image);
+    for (int i = 2; i <= MAX_INT_GRAM_LEN; i++) {
+        const auto& indexLayout = header->gramIndices[i];
+        if (indexLayout.size == 0) continue;
+        auto& index = searcher->gramIndices[i];
+        index.gramLen = i;
+        index.size = indexLayout.size;
+        index.grams = reinterpret_cast<Gram*>(base + indexLayout.grams);
+        index.offsets = reinterpret_cast<int*>(base + indexLayout.offsets);
+        index.postings = reinterpret_cast<Posting*>(base + indexLayout.postings);
+        index.numTokens = searcher->numUnique;
+    }
+    initQueryState(searcher);
+    syncMemory(searcher);
+    return searcher;
+}
+
+/**
+ * append documents to the index without rebuilding it. Their indices follow the indices of the existing documents
+ * @param buffer the fields of the documents, packed in the same way as in `getMultiFieldSearcher`
+ * @param offsets length = N * numFields + 1
+ * @param N the number of documents
+ * @note buffer and offsets will be freed before this function returns
+ */
+void addSentences(FastSearcher* searcher, char* buffer, const int* offsets, int N) {
+    const int numFields = searcher->numFields;
+    if (Capture::Record rec{Capture::Call::addSentences}) {
+        rec << Capture::Handle{searcher} << Capture::bytes(buffer, offsets[N * numFields])
+            << Capture::bytes(offsets, N * numFields + 1) << N;
+    }
+    normalize(buffer, buffer + offsets[N * numFields]);
+    detachIndex(searcher);
+    auto& sentences = searcher->mut->sentences;
+    for (int i = 0; i < N * numFields; i++) {
+        string_view text(buffer + offsets[i], offsets[i + 1] - offsets[i]);
+        sentences.push_back(appendSentence(searcher, text, sentences.size()));
+    }
+    free(buffer);
+    free((void*)offsets);
+    commitModification(searcher);
+}
+
+/**
+ * replace the fields of a document
+ * @param buffer the new fields of the document, packed in the same way as in `getMultiFieldSearcher`
+ * @param offsets length = numFields + 1
+ * @note buffer and offsets will be freed before this function returns
+ */
+void updateSentence(FastSearcher* searcher, int idx, char* buffer, const int* offsets) {
+    const int numFields = searcher->numFields;
+    if (Capture::Record rec{Capture::Call::updateSentence}) {
+        rec << Capture::Handle{searcher} << idx << Capture::bytes(buffer, offsets[numFields])
+            << Capture::bytes(offsets, numFields + 1);
+    }
+    normalize(buffer, buffer + offsets[numFields]);
+    detachIndex(searcher);
+    auto& mut = *searcher->mut;
+    for (int f = 0; f < numFields; f++) {
+        const int sentence = idx * numFields + f;
+        discardSentence(mut, mut.sentences[sentence]);
+        string_view text(buffer + offsets[f], offsets[f + 1] - offsets[f]);
+        auto entry = appendSentence(searcher, text, sentence);
+        mut.sentences[sentence] = entry;
+    }
+    free(buffer);
+    free((void*)offsets);
+    commitModification(searcher);
+}
+
+/**
+ * remove a document. Its index stays valid, but it becomes empty, so it never matches any query
+ */
+void removeSentence(FastSearcher* searcher, int idx) {
+    if (Capture::Record rec{Capture::Call::removeSentence}) rec << Capture::Handle{searcher} << idx;
+    detachIndex(searcher);
+    auto& mut = *searcher->mut;
+    for (int f = 0; f < searcher->numFields; f++) {
+        auto& entry = mut.sentences[idx * searcher->numFields + f];
+        discardSentence(mut, entry);
+        entry.textLength = entry.tokenCount = 0;
+    }
+    commitModification(searcher);
+}
+
+/**
+ * compact the index after it is modified. This also happens automatically when enough of the index is garbage
+ */
+void compactSearcher(FastSearcher* searcher) {
+    if (Capture::Record rec{Capture::Call::compactSearcher}) rec << Capture::Handle{searcher};
+    compactIndex(searcher);
+    syncMemory(searcher);
+}
+
+/**
+ * enable or disable typo tolerance. If enabled, tokens within a small edit distance of a query word (one edit for every three characters,
+ * at most maxDistance) are also matched, even if they have few n-grams in common with the query, e.g. "pyhs" and "phys".
+ * The deletion index used to find them is built on the first call that needs it
+ * @param maxDistance the maximum edit distance, usually 1 or 2. 0 disables typo tolerance
+ * @param weight the score of a token at edit distance d from a query word of length n is weight * (1 - d / n)
+ */
+void setTypoTolerance(FastSearcher* searcher, int maxDistance, float weight) {
+    if (Capture::Record rec{Capture::Call::setTypoTolerance}) rec << Capture::Handle{searcher} << maxDistance << weight;
+    auto& index = searcher->typoIndex;
+    if (maxDistance > index.builtDistance) buildTypoIndex(searcher, maxDistance);
+    index.maxDistance = maxDistance;
+    index.weight = weight;
+    // the scores of the last query are no longer valid
+    resetQueryState(searcher, 0);
+    clearResultCache(searcher);
+    syncMemory(searcher);
+}
+
+/**
+ * set the number of threads of the shared pool that score the tokens and the sentences of a query.
+ * Has no effect unless compiled with USE_THREADS
+ */
+void setNumThreads(FastSearcher* searcher, int numThreads) {
+    if (Capture::Record rec{Capture::Call::setNumThreads}) rec << Capture::Handle{searcher} << numThreads;
+#ifdef USE_THREADS
+    searcher->numThreads = clamp(numThreads, 1, ThreadPool::MAX_THREADS);
+    delete[] searcher->context.scoreWindow;
+    searcher->context.scoreWindow = new float[searcher->maxTokenLen * searcher->numThreads];
+    syncMemory(searcher);
+#endif
+}
+
+/**
+ * create a token dictionary that can be shared by several searchers. The caller holds one reference to it
+ */
+Dictionary* createDictionary() {
+    return new Dictionary();
+}
+
+/**
+ * release a reference to a dictionary, and free it if it was the last one
+ */
+void releaseDictionary(Dictionary* dict) {
+    if (--dict->refCount > 0) return;
+    for (auto& index : dict->gramIndices) free(index.mem);
+    delete dict;
+}
+
+/**
+ * attach a searcher to a shared dictionary, which is then used to match the tokens of its queries.
+ * The tokens of the searcher are added to the dictionary, and the gram indices of the searcher are freed.
+ * The searcher holds a reference to the dictionary until it is deleted
+ */
+void attachDictionary(FastSearcher* searcher, Dictionary* dict) {
+    dict->refCount++;
+    if (searcher->dict) releaseDictionary(searcher->dict);
+    searcher->dict = dict;
+    searcher->localIds.clear();
+    searcher->numDictTokens = 0;
+    syncDictionary(searcher);
+    for (auto& index : searcher->gramIndices) {
+        free(index.mem);
+        index = GramIndex();
+    }
+    resetQueryState(searcher, 0);
+    // the cached states refer to the generations of the previous dictionary
+    clearResultCache(searcher);
+    syncMemory(searcher);
 }
 
 void deleteSearcher(FastSearcher* searcher) {
-    delete[] searcher->sentences;
-    delete[] searcher->indices;
-    delete[] searcher->scoreWindow;
+    if (Capture::Record rec{Capture::Call::deleteSearcher}) rec << Capture::Handle{searcher};
+    const MemoryCategory categories[] = {MEMORY_SEARCH_INDEX, MEMORY_SEARCH_QUERY, MEMORY_SEARCH_CACHE};
+    for (int i = 0; i < 3; i++) Memory::track(categories[i], -searcher->memory[i]);
+    if (searcher->dict) releaseDictionary(searcher->dict);
+    free(searcher->arena);
+    for (auto& index : searcher->gramIndices) free(index.mem);
+    free(searcher->typoIndex.mem);
+    free(searcher->suffixIndex.mem);
+    delete searcher->mut;
+    delete[] searcher->context.indices;
+    delete[] searcher->context.scoreWindow;
     delete searcher;
 }
 }  // end extern "C"
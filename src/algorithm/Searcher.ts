@@ -18,9 +18,8 @@ export interface SearchResult<T, K = string> {
 }
 
 function allocateStr(Module: EMModule, str: string) {
-    // TODO: handle complete UTF-8
-    // stringToUT8 will write exactly strLen number of bytes only if str contains ASCII characters only
-    const strLen = str.length + 1;
+    // one more byte for the null terminator
+    const strLen = Module.lengthBytesUTF8(str) + 1;
     const ptr = Module._malloc(strLen);
     Module.stringToUTF8(str, ptr, strLen);
     return ptr;
@@ -31,7 +30,9 @@ function allocateStr(Module: EMModule, str: string) {
  * returns -1 if query is shorter than gramLen
  */
 function prepareQuery(Module: EMModule, query: string, gramLen: number) {
+    // fold punctuation into spaces, the same way the indexed strings are normalized on the native side
     query = query
+        .replace(/[!-\/:-@\[-`{-~]/g, ' ')
         .trim()
         .toLowerCase()
         .replace(/\s+/g, ' ');
@@ -39,6 +40,110 @@ function prepareQuery(Module: EMModule, query: string, gramLen: number) {
     return allocateStr(Module, query);
 }
 
+/**
+ * map the UTF-8 byte offsets of the lower-cased string, which is what the native side indexes, to UTF-16 code unit indices of the string.
+ * Grams are bytes, so a match may start or end inside a character: table[i] is the index of the character that contains byte i
+ * @returns undefined for ASCII strings, whose byte offsets are their indices
+ */
+function byteOffsetTable(str: string, lower: string) {
+    if (!/[^\x00-\x7f]/.test(str)) return undefined;
+    const table: number[] = [];
+    // i indexes str, and j indexes lower. Lower-casing may change the length of a character, e.g. İ
+    for (let i = 0, j = 0; i < str.length; ) {
+        const charLen = str.codePointAt(i)! > 0xffff ? 2 : 1;
+        const end = Math.min(j + str.substr(i, charLen).toLowerCase().length, lower.length);
+        while (j < end) {
+            const code = lower.codePointAt(j)!;
+            const numBytes = code < 0x80 ? 1 : code < 0x800 ? 2 : code < 0x10000 ? 3 : 4;
+            for (let k = 0; k < numBytes; k++) table.push(i);
+            j += code > 0xffff ? 2 : 1;
+        }
+        i += charLen;
+    }
+    table.push(str.length);
+    return Int32Array.from(table);
+}
+
+/**
+ * convert the [start, end) byte offsets of matches to code unit indices. A match that ends inside a character includes it
+ */
+function toUnitOffsets(matches: Int32Array, table?: Int32Array) {
+    if (!table) return matches;
+    const result = new Int32Array(matches.length);
+    for (let i = 0; i < matches.length; i += 2) {
+        result[i] = table[matches[i]];
+        let end = matches[i + 1];
+        while (end < table.length - 1 && table[end] === table[end - 1]) end++;
+        result[i + 1] = table[end];
+    }
+    return result;
+}
+
+/**
+ * pack strings into a single buffer on the WebAssembly heap, delimited by an array of N + 1 byte offsets.
+ * The strings are lower-cased here, like the queries in prepareQuery, because the native side only lower-cases ASCII.
+ * Punctuation folding is done natively on the whole buffer
+ * @returns pointers to the buffer and to the offsets, and the byte offset table of each string, see byteOffsetTable
+ */
+function packStrings(Module: EMModule, _strs: readonly string[]) {
+    const strs = _strs.map(str => str.toLowerCase());
+    const tables = _strs.map((str, i) => byteOffsetTable(str, strs[i]));
+    const offsets = new Int32Array(strs.length + 1);
+    for (let i = 0; i < strs.length; i++)
+        offsets[i + 1] = offsets[i] + Module.lengthBytesUTF8(strs[i]);
+
+    const total = offsets[strs.length];
+    // one more byte for the null terminator written by stringToUTF8
+    const bufferPtr = Module._malloc(total + 1);
+    const offsetsPtr = Module._malloc(offsets.byteLength);
+    for (let i = 0; i < strs.length; i++)
+        Module.stringToUTF8(strs[i], bufferPtr + offsets[i], total + 1 - offsets[i]);
+    Module.HEAP32.set(offsets, offsetsPtr / 4);
+    return [bufferPtr, offsetsPtr, tables] as const;
+}
+
+/**
+ * copy an index image to the WebAssembly heap and load a searcher from it
+ * @param numSentences the number of strings the index should have, so that an image of other items is not loaded
+ * @returns the pointer to the searcher, or 0 if the image is invalid or stale. The caller should then build the index
+ */
+function loadImage(Module: EMModule, image: Uint8Array, numSentences: number) {
+    // the number of sentences is the fourth int32 of the header
+    if (image.byteLength < 16) return 0;
+    if (new DataView(image.buffer, image.byteOffset, 16).getInt32(12, true) !== numSentences) return 0;
+    const imagePtr = Module._malloc(image.byteLength);
+    Module.HEAPU8.set(image, imagePtr);
+    return Module._loadSearcher(imagePtr, image.byteLength);
+}
+
+function serializeImage(Module: EMModule, ptr: number) {
+    const imagePtr = Module._serializeSearcher(ptr);
+    // the size of the image is stored in the third uint32 of its header
+    const size = Module.HEAPU32[imagePtr / 4 + 2];
+    const image = Module.HEAPU8.slice(imagePtr, imagePtr + size);
+    Module._free(imagePtr);
+    return image;
+}
+
+/**
+ * a token dictionary shared by several searchers whose vocabularies overlap, e.g. the searchers of several semesters.
+ * The tokens of a query are matched once by the dictionary for all searchers attached to it
+ */
+export class SearchDictionary {
+    /** internal pointer to the Dictionary instance on WASM heap */
+    public readonly ptr: number;
+    constructor() {
+        this.ptr = window.NativeModule._createDictionary();
+    }
+
+    /**
+     * release this reference to the dictionary. It is freed once the searchers attached to it are deleted as well
+     */
+    public release() {
+        window.NativeModule._releaseDictionary(this.ptr);
+    }
+}
+
 /**
  * Fast searcher for fuzzy search among a list of strings
  */
@@ -46,42 +151,129 @@ export class FastSearcher<T, K = string> {
     public readonly originals: string[] = [];
     /** internal pointer to the FastSearcher instance on WASM heap */
     private readonly ptr: number;
+    /** the byte offset table of each item, see byteOffsetTable */
+    private readonly tables: (Int32Array | undefined)[];
+    /**
+     * @param image an index image previously obtained from [[FastSearcher.serialize]] for the same items.
+     * If provided and valid, the index is loaded from it instead of being built from the items
+     */
     constructor(
         items: readonly T[],
-        toStr: (a: T) => string = x => x as any,
-        public data: K = '' as any
+        private readonly toStr: (a: T) => string = x => x as any,
+        public data: K = '' as any,
+        image?: Uint8Array
     ) {
         const Module = window.NativeModule;
-        const strArrPtr = Module._malloc(items.length * 4);
-        for (let i = 0; i < items.length; i++) {
-            const str = toStr(items[i]);
-            this.originals.push(str);
-            Module.HEAPU32[strArrPtr / 4 + i] = allocateStr(Module, str.trim().toLowerCase());
+        for (const item of items) this.originals.push(toStr(item));
+        if (image) {
+            this.ptr = loadImage(Module, image, items.length);
+            this.tables = this.originals.map(str => byteOffsetTable(str, str.toLowerCase()));
+            if (this.ptr) return;
         }
-        this.ptr = Module._getSearcher(strArrPtr, items.length);
+        const [bufferPtr, offsetsPtr, tables] = packStrings(Module, this.originals);
+        this.tables = tables;
+        this.ptr = Module._getSearcherPacked(bufferPtr, offsetsPtr, items.length);
+    }
+
+    /**
+     * serialize the index of this searcher into a binary image, which can be passed to the constructor to skip building the index
+     */
+    public serialize() {
+        return serializeImage(window.NativeModule, this.ptr);
+    }
+
+    /**
+     * enable typo tolerance: tokens within a small edit distance of a query word are also matched,
+     * e.g. "pyhs" matches "phys", which share no n-grams
+     * @param maxDistance the maximum edit distance. 0 disables typo tolerance
+     * @param weight the weight of a match by edit distance, relative to an exact match
+     */
+    public setTypoTolerance(maxDistance = 2, weight = 0.8) {
+        window.NativeModule._setTypoTolerance(this.ptr, maxDistance, weight);
+    }
+
+    /**
+     * share the token dictionary of the other searchers attached to `dict`
+     */
+    public attachDictionary(dict: SearchDictionary) {
+        window.NativeModule._attachDictionary(this.ptr, dict.ptr);
+    }
+
+    /**
+     * append items to the index, without rebuilding it
+     */
+    public addItems(items: readonly T[]) {
+        const strs = items.map(this.toStr);
+        const [bufferPtr, offsetsPtr, tables] = packStrings(window.NativeModule, strs);
+        window.NativeModule._addSentences(this.ptr, bufferPtr, offsetsPtr, items.length);
+        this.originals.push(...strs);
+        this.tables.push(...tables);
+    }
+
+    /**
+     * replace the item at the given index
+     */
+    public updateItem(index: number, item: T) {
+        const str = this.toStr(item);
+        const [bufferPtr, offsetsPtr, [table]] = packStrings(window.NativeModule, [str]);
+        window.NativeModule._updateSentence(this.ptr, index, bufferPtr, offsetsPtr);
+        this.originals[index] = str;
+        this.tables[index] = table;
+    }
+
+    /**
+     * remove the item at the given index. The indices of the other items are not changed
+     */
+    public removeItem(index: number) {
+        window.NativeModule._removeSentence(this.ptr, index);
+        this.originals[index] = '';
+        this.tables[index] = undefined;
     }
 
     sWSearch(query: string, numResults: number, gramLen = 3, threshold = 0.1) {
         const Module = window.NativeModule;
         const ptr = prepareQuery(Module, query, gramLen);
-        const allMatches: SearchResult<T, K>[] = [];
-        if (ptr === -1) return allMatches;
+        if (ptr === -1) return [];
 
-        const resultPtr = Module._sWSearch(this.ptr, ptr, numResults, gramLen, threshold) / 4;
-        const total = Math.min(numResults, this.originals.length);
-        const idxArr = Module.HEAP32.subarray(resultPtr, resultPtr + total);
+        Module._sWSearch(this.ptr, ptr, numResults, gramLen, threshold);
+        return this.getResults();
+    }
+
+    /**
+     * exact substring search, e.g. for course numbers. Each item containing the query has a score of 1,
+     * and the matches are the occurrences of the query. The index used by this search is built on the first call
+     * @param prefixOnly only match the query at the start of a word
+     */
+    substringSearch(query: string, maxResults: number, prefixOnly = false) {
+        const Module = window.NativeModule;
+        const ptr = prepareQuery(Module, query, 1);
+        if (ptr === -1) return [];
+
+        Module._substringSearch(this.ptr, ptr, maxResults, +prefixOnly);
+        return this.getResults();
+    }
+
+    /**
+     * decode the results of the last query, which are packed in a single buffer by the native side
+     */
+    private getResults() {
+        const Module = window.NativeModule;
+        const allMatches: SearchResult<T, K>[] = [];
+        let p = Module._getResultsPacked(this.ptr) / 4;
+        const total = Module.HEAP32[p++];
         for (let i = 0; i < total; i++) {
-            const idx = idxArr[i];
-            const matchPtr = Module._getMatches(this.ptr, idx) / 4;
+            const index = Module.HEAP32[p];
+            const score = Module.HEAPF32[p + 1];
+            // the score of the only field is the same as the score of the item
+            const numMatches = Module.HEAP32[p + 3];
+            p += 4;
             allMatches.push({
-                score: Module._getScore(this.ptr, idx),
-                index: idx,
+                score,
+                index,
                 data: this.data,
-                matches: Module.HEAP32.subarray(
-                    matchPtr,
-                    matchPtr + Module._getMatchSize(this.ptr, idx) * 2
-                )
+                matches: toUnitOffsets(Module.HEAP32.subarray(p, p + numMatches * 2), this.tables[index])
             });
+            p += numMatches * 2;
         }
         return allMatches;
     }
@@ -104,4 +296,181 @@ export class FastSearcher<T, K = string> {
     }
 }
 
+/**
+ * a field of the items indexed by a [[MultiFieldSearcher]]
+ */
+export interface SearchField<T, K extends string> {
+    /** the name of this field, used as the data of its search results */
+    name: K;
+    /** the weight of this field in the score of an item */
+    weight: number;
+    toStr: (a: T) => string;
+}
+
+/**
+ * The structure of the object used to store the search results of a [[MultiFieldSearcher]]
+ */
+export interface MultiFieldSearchResult<K extends string> {
+    /** the weighted sum of the scores of the fields */
+    score: number;
+    /** index of the item in the original list */
+    index: number;
+    /** results of the fields with a nonzero score, in the order of the fields */
+    fields: SearchResult<unknown, K>[];
+}
+
+/**
+ * Fuzzy searcher for items with several fields, e.g. the title and the description of a course.
+ * All fields are indexed by a single native searcher, so that one query ranks the items by the weighted sum of the scores of their fields
+ */
+export class MultiFieldSearcher<T, K extends string> {
+    /** internal pointer to the FastSearcher instance on WASM heap */
+    private readonly ptr: number;
+    /** the byte offset table of each field of each item, in item-major order, see byteOffsetTable */
+    private readonly tables: (Int32Array | undefined)[];
+    /**
+     * @param image an index image previously obtained from [[MultiFieldSearcher.serialize]] for the same items and fields
+     */
+    constructor(
+        items: readonly T[],
+        public readonly fields: readonly SearchField<T, K>[],
+        image?: Uint8Array
+    ) {
+        const Module = window.NativeModule;
+        if (image) {
+            this.ptr = loadImage(Module, image, items.length * fields.length);
+            this.tables = this.fieldStrings(items).map(str => byteOffsetTable(str, str.toLowerCase()));
+            if (this.ptr) return;
+        }
+        const [bufferPtr, offsetsPtr, tables] = packStrings(Module, this.fieldStrings(items));
+        this.tables = tables;
+
+        const weightsPtr = Module._malloc(fields.length * 4);
+        Module.HEAPF32.set(
+            fields.map(field => field.weight),
+            weightsPtr / 4
+        );
+        this.ptr = Module._getMultiFieldSearcher(
+            bufferPtr,
+            offsetsPtr,
+            items.length,
+            weightsPtr,
+            fields.length
+        );
+    }
+
+    public serialize() {
+        return serializeImage(window.NativeModule, this.ptr);
+    }
+
+    /**
+     * enable typo tolerance: tokens within a small edit distance of a query word are also matched,
+     * e.g. "pyhs" matches "phys", which share no n-grams
+     * @param maxDistance the maximum edit distance. 0 disables typo tolerance
+     * @param weight the weight of a match by edit distance, relative to an exact match
+     */
+    public setTypoTolerance(maxDistance = 2, weight = 0.8) {
+        window.NativeModule._setTypoTolerance(this.ptr, maxDistance, weight);
+    }
+
+    /**
+     * @see [[FastSearcher.attachDictionary]]
+     */
+    public attachDictionary(dict: SearchDictionary) {
+        window.NativeModule._attachDictionary(this.ptr, dict.ptr);
+    }
+
+    /**
+     * append items to the index, without rebuilding it
+     */
+    public addItems(items: readonly T[]) {
+        const [bufferPtr, offsetsPtr, tables] = packStrings(window.NativeModule, this.fieldStrings(items));
+        window.NativeModule._addSentences(this.ptr, bufferPtr, offsetsPtr, items.length);
+        this.tables.push(...tables);
+    }
+
+    /**
+     * replace the item at the given index
+     */
+    public updateItem(index: number, item: T) {
+        const [bufferPtr, offsetsPtr, tables] = packStrings(window.NativeModule, this.fieldStrings([item]));
+        window.NativeModule._updateSentence(this.ptr, index, bufferPtr, offsetsPtr);
+        this.tables.splice(index * this.fields.length, tables.length, ...tables);
+    }
+
+    /**
+     * remove the item at the given index. The indices of the other items are not changed
+     */
+    public removeItem(index: number) {
+        window.NativeModule._removeSentence(this.ptr, index);
+        this.tables.fill(undefined, index * this.fields.length, (index + 1) * this.fields.length);
+    }
+
+    /**
+     * @returns the fields of the items, in item-major order
+     */
+    private fieldStrings(items: readonly T[]) {
+        const strs: string[] = [];
+        for (const item of items) for (const field of this.fields) strs.push(field.toStr(item));
+        return strs;
+    }
+
+    sWSearch(query: string, numResults: number, gramLen = 3, threshold = 0.1) {
+        const Module = window.NativeModule;
+        const ptr = prepareQuery(Module, query, gramLen);
+        if (ptr === -1) return [];
+
+        Module._sWSearch(this.ptr, ptr, numResults, gramLen, threshold);
+        return this.getResults();
+    }
+
+    /**
+     * exact substring search. The score of an item is the sum of the weights of its fields that contain the query
+     * @see [[FastSearcher.substringSearch]]
+     */
+    substringSearch(query: string, maxResults: number, prefixOnly = false) {
+        const Module = window.NativeModule;
+        const ptr = prepareQuery(Module, query, 1);
+        if (ptr === -1) return [];
+
+        Module._substringSearch(this.ptr, ptr, maxResults, +prefixOnly);
+        return this.getResults();
+    }
+
+    /**
+     * decode the results of the last query, which are packed in a single buffer by the native side
+     */
+    private getResults() {
+        const Module = window.NativeModule;
+        const allMatches: MultiFieldSearchResult<K>[] = [];
+        let p = Module._getResultsPacked(this.ptr) / 4;
+        const total = Module.HEAP32[p++];
+        for (let i = 0; i < total; i++) {
+            const index = Module.HEAP32[p];
+            const score = Module.HEAPF32[p + 1];
+            p += 2;
+            const fields: SearchResult<unknown, K>[] = [];
+            for (const [f, { name }] of this.fields.entries()) {
+                const fieldScore = Module.HEAPF32[p];
+                const numMatches = Module.HEAP32[p + 1];
+                p += 2;
+                if (fieldScore !== 0) {
+                    fields.push({
+                        score: fieldScore,
+                        index,
+                        data: name,
+                        matches: toUnitOffsets(
+                            Module.HEAP32.subarray(p, p + numMatches * 2),
+                            this.tables[index * this.fields.length + f]
+                        )
+                    });
+                }
+                p += numMatches * 2;
+            }
+            allMatches.push({ score, index, fields });
+        }
+        return allMatches;
+    }
+}
+
 (window as any).FastSearcher = FastSearcher;
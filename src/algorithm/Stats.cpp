@@ -0,0 +1,24 @@
+#include <cstring>
+
+#include "Stats.h"
+
+extern "C" {
+
+/**
+ * @returns the counters and phase timers of the engines, see Stats.h. They are all 0 unless compiled with ENGINE_STATS
+ */
+const EngineStats* getStats() {
+#ifdef ENGINE_STATS
+    return &Stats::stats;
+#else
+    static const EngineStats empty{};
+    return &empty;
+#endif
+}
+
+void resetStats() {
+#ifdef ENGINE_STATS
+    memset(&Stats::stats, 0, sizeof(EngineStats));
+#endif
+}
+}
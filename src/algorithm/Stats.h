@@ -0,0 +1,95 @@
+/**
+ * counters of the hot paths of the engines and timers of their phases, compiled in with -DENGINE_STATS (`make ... STATS=1`).
+ * Without it, the macros below expand to nothing, so they cost nothing.
+ *
+ * The host reads the EngineStats returned by getStats directly: its layout is fixed, and fields are only appended.
+ * With threads, the counters and the timers of all threads are summed
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+typedef struct EngineStats {
+    // ------------ counters ------------
+    /** sections placed in a schedule by the depth first search of generate */
+    uint64_t dfsNodes;
+    /** lookups of the conflict cache by generate */
+    uint64_t conflictChecks;
+    /** returns to the previous course by generate */
+    uint64_t backtracks;
+    /** uint16 elements moved by the insertion sort of addToEval */
+    uint64_t evalMoves;
+    /** evaluations of a sort function on a schedule */
+    uint64_t metricEvals;
+    /** LP and MILP problems built by the renderer */
+    uint64_t lpProblems;
+    /** calls to glp_simplex and their simplex iterations */
+    uint64_t simplexCalls;
+    uint64_t simplexIterations;
+    /** tokens and sentences scored by sWSearch */
+    uint64_t tokensScored;
+    uint64_t sentencesScored;
+
+    // ------------ phase timers, in nanoseconds ------------
+    /** including addToEval */
+    uint64_t generateNs;
+    uint64_t addToEvalNs;
+    /** computing the coefficients of the sort functions */
+    uint64_t coeffNs;
+    /** sorting the indices by the coefficients */
+    uint64_t sortNs;
+    /** computing the blocks of a day, including the LP */
+    uint64_t renderNs;
+    uint64_t simplexNs;
+    /** building the index of a searcher */
+    uint64_t searchBuildNs;
+    uint64_t searchNs;
+} EngineStats;
+
+#ifdef __cplusplus
+#ifdef ENGINE_STATS
+#include <chrono>
+
+namespace Stats {
+
+/** one copy per module, shared by the engines linked into it. The host sums the modules. The exported functions that read it are in Stats.cpp */
+inline EngineStats stats;
+
+inline void add(uint64_t& field, uint64_t n) {
+#ifdef USE_THREADS
+    __atomic_fetch_add(&field, n, __ATOMIC_RELAXED);
+#else
+    field += n;
+#endif
+}
+
+/** adds the time from its construction to its destruction to a field */
+class Timer {
+public:
+    explicit Timer(uint64_t& field) : field(field), start(std::chrono::steady_clock::now()) {}
+    ~Timer() {
+        add(field, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    uint64_t& field;
+    std::chrono::steady_clock::time_point start;
+};
+
+}  // namespace Stats
+
+/** add n to a counter */
+#define STATS_ADD(field, n) Stats::add(Stats::stats.field, n)
+/** time the rest of the scope */
+#define STATS_TIMER(field) Stats::Timer statsTimer_##field(Stats::stats.field)
+/** code that only exists to count, e.g. local counters that are added once at the end of a loop */
+#define STATS_ONLY(...) __VA_ARGS__
+#else
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_TIMER(field) ((void)0)
+#define STATS_ONLY(...)
+#endif
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#include "Capture.h"
+#include "ThreadPool.h"
+
+extern "C" {
+
+/**
+ * set the number of threads of the pool shared by the engines of this module, including the calling thread.
+ * It is clamped to [1, MAX_THREADS], and defaults to the number of cores. Has no effect unless compiled with USE_THREADS
+ */
+void setPoolSize(int numThreads) {
+    if (Capture::Record rec{Capture::Call::setPoolSize}) rec << numThreads;
+#ifdef USE_THREADS
+    ThreadPool::pool().resize(numThreads);
+#endif
+}
+
+int getPoolSize() {
+    return ThreadPool::size();
+}
+}
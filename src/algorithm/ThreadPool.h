@@ -0,0 +1,170 @@
+/**
+ * the thread pool shared by the engines of a module: the generator and the searcher in the core module, the renderer in its own.
+ * Threads are only available in the threaded builds (compiled with USE_THREADS, see the *-threads targets of the Makefile).
+ * Without them, or if the pool has a single thread, parallelFor runs the loop on the calling thread
+ */
+#pragma once
+
+#include <algorithm>
+
+#ifdef USE_THREADS
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+namespace ThreadPool {
+
+#ifndef POOL_MAX_THREADS
+#define POOL_MAX_THREADS 8
+#endif
+
+/**
+ * the maximum number of threads of the pool, including the calling thread. The renderer module is built with a smaller one,
+ * so that the pools of both modules together do not oversubscribe the cores (RENDERER_MAX_THREADS in the Makefile).
+ * In the wasm build, at least MAX_THREADS - 1 workers must be created at startup (PTHREAD_POOL_SIZE),
+ * because a web worker cannot be started while the main thread is blocked waiting for it
+ */
+constexpr int MAX_THREADS = POOL_MAX_THREADS;
+
+#ifdef USE_THREADS
+
+class Pool {
+public:
+    Pool() : numThreads(std::clamp(static_cast<int>(std::thread::hardware_concurrency()), 1, MAX_THREADS)) {}
+    ~Pool() { stopWorkers(); }
+
+    int size() const { return numThreads; }
+
+    void resize(int n) {
+        std::lock_guard<std::mutex> running(runLock);
+        stopWorkers();
+        numThreads = std::clamp(n, 1, MAX_THREADS);
+    }
+
+    /**
+     * call job(w) for each w in [0, n), with job(0) on the calling thread, and wait for all of them to finish.
+     * Nested calls, from a worker of the pool or from job(0) on the calling thread, run all jobs on the current thread
+     * @param n the number of jobs, at most size()
+     */
+    void run(int n, const std::function<void(int)>& job) {
+        if (n <= 1 || isWorker()) {
+            for (int w = 0; w < n; w++) job(w);
+            return;
+        }
+        std::lock_guard<std::mutex> running(runLock);
+        {
+            std::lock_guard<std::mutex> lock(m);
+            // workers are started on the first use, so builds that never run in parallel have no threads
+            for (int w = threads.size() + 1; w < numThreads; w++) threads.emplace_back(&Pool::work, this, w, generation);
+            current = &job;
+            numJobs = n;
+            pending = n - 1;
+            generation++;
+        }
+        wake.notify_all();
+        {
+            // the caller holds runLock until the workers are done: nested calls must not wait for it
+            InRun inRun;
+            job(0);
+        }
+        std::unique_lock<std::mutex> lock(m);
+        done.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    int numThreads;
+    std::vector<std::thread> threads;
+    /** serializes run and resize */
+    std::mutex runLock;
+    /** guards the fields below */
+    std::mutex m;
+    std::condition_variable wake, done;
+    const std::function<void(int)>* current = nullptr;
+    int numJobs = 0;
+    /** the number of jobs on the workers that have not finished */
+    int pending = 0;
+    /** incremented for each run, so that a worker does not run the same jobs twice */
+    uint64_t generation = 0;
+    bool stop = false;
+
+    /** true on the workers, and on the calling thread while it runs job(0) */
+    static bool& isWorker() {
+        thread_local bool flag = false;
+        return flag;
+    }
+
+    struct InRun {
+        InRun() { isWorker() = true; }
+        ~InRun() { isWorker() = false; }
+    };
+
+    void work(int w, uint64_t seen) {
+        isWorker() = true;
+        std::unique_lock<std::mutex> lock(m);
+        while (true) {
+            wake.wait(lock, [&] { return stop || generation != seen; });
+            if (stop) return;
+            seen = generation;
+            if (w >= numJobs) continue;
+            const auto* job = current;
+            lock.unlock();
+            (*job)(w);
+            lock.lock();
+            if (--pending == 0) done.notify_one();
+        }
+    }
+
+    void stopWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+        threads.clear();
+        stop = false;
+    }
+};
+
+inline Pool& pool() {
+    static Pool instance;
+    return instance;
+}
+
+#endif
+
+/**
+ * the number of threads of the pool, including the calling thread. Always 1 without USE_THREADS
+ */
+inline int size() {
+#ifdef USE_THREADS
+    return pool().size();
+#else
+    return 1;
+#endif
+}
+
+/**
+ * call f(worker, begin, end) on consecutive chunks of [0, count), one chunk for each worker.
+ * If there is little work, or no threads, f(0, 0, count) is called on the current thread
+ * @param minWork a chunk has at least this many iterations
+ * @param maxWorkers use at most this many workers
+ */
+template <typename F>
+inline void parallelFor(int count, int minWork, F&& f, int maxWorkers = MAX_THREADS) {
+#ifdef USE_THREADS
+    const int numWorkers = std::min({size(), maxWorkers, count / std::max(minWork, 1)});
+    if (numWorkers > 1) {
+        const int chunk = (count + numWorkers - 1) / numWorkers;
+        pool().run(numWorkers, [&](int w) { f(w, std::min(count, w * chunk), std::min(count, (w + 1) * chunk)); });
+        return;
+    }
+#endif
+    f(0, 0, count);
+}
+
+}  // namespace ThreadPool
@@ -0,0 +1,47 @@
+#include <cstdio>
+#include <string>
+
+#include "Tracer.h"
+
+extern "C" {
+
+/**
+ * start (nonzero) or stop recording the spans of the phases of the engines. Starting discards the previous spans,
+ * stopping keeps them so that they can be read with getTraceEvents
+ */
+void setTracing(int enabled) {
+    if (enabled) {
+        Tracer::events.assign(Tracer::CAPACITY, {});
+        Tracer::numEvents = 0;
+        Tracer::epoch = Tracer::Clock::now();
+    }
+    Tracer::enabled = enabled;
+}
+
+static std::string traceJSON;
+
+/**
+ * serialize the spans recorded so far as Chrome trace-event JSON
+ * @returns a NULL-terminated string, valid until the next call. Its length is given by getTraceEventsSize
+ */
+const char* getTraceEvents() {
+    const uint64_t total = Tracer::numEvents;
+    const uint64_t first = total > Tracer::CAPACITY ? total - Tracer::CAPACITY : 0;
+    traceJSON = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    char buffer[256];
+    for (uint64_t i = first; i < total; i++) {
+        const auto& event = Tracer::events[i % Tracer::CAPACITY];
+        const auto* names = Tracer::PHASE_NAMES[static_cast<int>(event.phase)];
+        // complete events ("X"), with the timestamp and the duration in microseconds
+        snprintf(buffer, sizeof(buffer), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"%s\":%d}}",
+                 i == first ? "" : ",", names[0], event.thread, event.start / 1000.0, (event.end - event.start) / 1000.0, names[1], event.arg);
+        traceJSON += buffer;
+    }
+    traceJSON += "]}";
+    return traceJSON.c_str();
+}
+
+int getTraceEventsSize() {
+    return traceJSON.size();
+}
+}
@@ -0,0 +1,109 @@
+/**
+ * spans of the phases of the engines, recorded in a ring buffer so that a slow interaction can be viewed on a timeline.
+ * Tracing is off until it is enabled with setTracing, and costs a branch per span otherwise.
+ * getTraceEvents serializes the spans as Chrome trace-event JSON, which can be opened in about:tracing or https://ui.perfetto.dev
+ *
+ * Usage: `Tracer::Span span{Tracer::Phase::x, arg};` records the rest of the scope
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#ifdef USE_THREADS
+#include <atomic>
+#endif
+
+namespace Tracer {
+
+/** the number of spans kept. Older spans are overwritten */
+constexpr uint32_t CAPACITY = 1 << 14;
+
+enum class Phase : uint16_t {
+    // ScheduleGenerator.cpp
+    generate,
+    addToEval,
+    computeCoeff,
+    sort,
+    // Renderer.cpp
+    render,
+    intervalScheduling,
+    adjacencyList,
+    dfsWidthExpansion,
+    lpIterations,
+    lp,
+    milp,
+    // Searcher.cpp
+    searchBuild,
+    search,
+    numPhases
+};
+
+/** the name of each phase, and the name of its argument */
+constexpr const char* PHASE_NAMES[][2] = {
+    {"generate", "courses"},
+    {"addToEval", "schedules"},
+    {"computeCoeff", "metric"},
+    {"sort", "schedules"},
+    {"render", "blocks"},
+    {"STEP 1 intervalScheduling", "blocks"},
+    {"STEP 2 constructAdjList", "columns"},
+    {"STEP 4 dfsWidthExpansion", "blocks"},
+    {"STEP 5 LP iterations", "blocks"},
+    {"LP", "blocks"},
+    {"MILP", "blocks"},
+    {"searchBuild", "sentences"},
+    {"search", "queryLength"},
+};
+static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) == static_cast<int>(Phase::numPhases));
+
+struct Event {
+    Phase phase;
+    uint16_t thread;
+    int32_t arg;
+    /** in nanoseconds since tracing was enabled */
+    int64_t start, end;
+};
+
+using Clock = std::chrono::steady_clock;
+
+/** one copy per module, shared by the engines linked into it, so each module records its own events. The exported functions that read them are in Tracer.cpp */
+inline bool enabled = false;
+inline Clock::time_point epoch;
+inline std::vector<Event> events;
+#ifdef USE_THREADS
+inline std::atomic<uint64_t> numEvents{0};
+inline std::atomic<uint16_t> numThreads{0};
+#else
+inline uint64_t numEvents = 0;
+#endif
+
+inline uint16_t threadId() {
+#ifdef USE_THREADS
+    thread_local const uint16_t id = numThreads++;
+    return id;
+#else
+    return 0;
+#endif
+}
+
+inline int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+}
+
+class Span {
+public:
+    explicit Span(Phase phase, int arg = 0) : phase(phase), arg(arg), start(enabled ? now() : -1) {}
+    ~Span() {
+        if (start < 0 || !enabled) return;
+        events[numEvents++ % CAPACITY] = {phase, threadId(), arg, start, now()};
+    }
+
+private:
+    Phase phase;
+    int32_t arg;
+    int64_t start;
+};
+
+}  // namespace Tracer
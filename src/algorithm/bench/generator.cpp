@@ -0,0 +1,320 @@
+/**
+ * benchmark of ScheduleGenerator.cpp: `make bench-generator && ./bench-generator [options] [traces]`
+ *
+ * Without input files, a few synthetic catalogs are generated, or a single one with the given options:
+ *   --courses N      number of courses
+ *   --sections N     sections per course
+ *   --meetings N     meetings per section
+ *   --conflicts P    probability that two sections of different courses conflict
+ *   --max N          maximum number of schedules
+ *   --runs N         number of runs of each case; the median is reported
+ *   --threads N      size of the thread pool (with USE_THREADS)
+ *   --json           print one JSON object per case instead of a table
+ *
+ * A trace is captured from a real session with setCapture (window.captureNative in the browser), see Capture.h.
+ * Each call to generate in it is a case, with the time matrix set by the last call to setTimeMatrix before it.
+ * The app usually sets it before the capture starts: then a synthetic one is used. Other calls are ignored
+ *
+ * Reported: generate time and schedules/sec, the time of addToEval alone, the time of computeCoeffFor for each metric,
+ * the time of a combined and a fallback sort over all metrics, the peak of the memory accounted by Memory.h,
+ * and the peak resident memory. Each case runs in a child process, so that its peaks do not include the other cases
+ */
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "../Capture.h"
+#include "../ScheduleGenerator.cpp"
+
+namespace SG = ScheduleGenerator;
+
+/** the metrics of sortFunctions that are benchmarked, excluding the random placeholder */
+constexpr int NUM_METRICS = 6;
+const char* metricNames[NUM_METRICS] = {"distance", "variance", "compactness", "lunchTime", "noEarly", "similarity"};
+/** number of buildings of the synthetic catalogs */
+constexpr int NUM_BUILDINGS = 64;
+
+struct Input {
+    string name;
+    int numCourses, maxNumSchedules;
+    vector<int> sectionLens;
+    vector<uint8_t> conflictCache;
+    vector<uint16_t> timeArray;
+    vector<int> timeMatrix;
+    int timeMatrixSize;
+};
+
+struct Result {
+    int count;
+    double generateMs, addToEvalMs, coeffMs[NUM_METRICS], sortMs, sortFallbackMs;
+};
+
+/**
+ * a time matrix of random walking times between buildings
+ */
+vector<int> syntheticTimeMatrix(int numBuildings) {
+    vector<int> matrix(numBuildings * numBuildings);
+    for (int i = 0; i < numBuildings * numBuildings; i++) matrix[i] = (i * 7919) % 900;
+    return matrix;
+}
+
+/**
+ * a catalog of random sections. Each meeting is 50 or 75 minutes on a random weekday,
+ * in a random building
+ */
+Input synthesize(const string& name, int numCourses, int sectionsPerCourse, int meetings, double conflictDensity, int maxNumSchedules) {
+    mt19937 rng(42);
+    Input input{name, numCourses, maxNumSchedules};
+    const int numSections = numCourses * sectionsPerCourse;
+    for (int i = 0; i <= numCourses; i++) input.sectionLens.push_back(i * sectionsPerCourse);
+
+    vector<uint16_t> content;
+    input.timeArray.resize(numSections * 8);
+    for (int s = 0; s < numSections; s++) {
+        vector<array<uint16_t, 3>> days[7];
+        for (int m = 0; m < meetings; m++) {
+            uint16_t start = 480 + rng() % 720;
+            days[rng() % 5].push_back({start, static_cast<uint16_t>(start + (rng() % 2 ? 50 : 75)), static_cast<uint16_t>(rng() % NUM_BUILDINGS)});
+        }
+        for (int d = 0; d < 7; d++) {
+            input.timeArray[s * 8 + d] = content.size();
+            for (auto& meeting : days[d]) content.insert(content.end(), meeting.begin(), meeting.end());
+        }
+        input.timeArray[s * 8 + 7] = content.size();
+    }
+    input.timeArray.insert(input.timeArray.end(), content.begin(), content.end());
+
+    input.timeMatrixSize = NUM_BUILDINGS;
+    input.timeMatrix = syntheticTimeMatrix(NUM_BUILDINGS);
+
+    input.conflictCache.resize(numSections * numSections);
+    uniform_real_distribution<double> uniform;
+    for (int a = 0; a < numSections; a++) {
+        for (int b = 0; b < a; b++) {
+            if (a / sectionsPerCourse != b / sectionsPerCourse && uniform(rng) < conflictDensity)
+                input.conflictCache[a * numSections + b] = input.conflictCache[b * numSections + a] = 1;
+        }
+    }
+    return input;
+}
+
+/**
+ * add a case for each call to generate in a trace
+ * @returns false if the file is not a trace, or if it is truncated
+ */
+bool load(const string& path, vector<Input>& inputs) {
+    ifstream file(path, ios::binary);
+    const vector<uint8_t> trace((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    size_t pos = 0;
+    auto read = [&](void* dst, size_t size) {
+        if (trace.size() - pos < size) return false;
+        memcpy(dst, trace.data() + pos, size);
+        pos += size;
+        return true;
+    };
+    /** a buffer argument: uint32 length followed by the bytes */
+    auto readBuffer = [&](auto& vec) {
+        uint32_t size;
+        if (!read(&size, 4)) return false;
+        vec.resize(size / sizeof(vec[0]));
+        return read(vec.data(), size);
+    };
+    uint32_t header[2];
+    if (!read(header, sizeof(header)) || header[0] != Capture::TRACE_MAGIC || header[1] > Capture::TRACE_VERSION) return false;
+    vector<int> timeMatrix;
+    int timeMatrixSize = 0, numCalls = 0;
+    while (pos < trace.size()) {
+        uint16_t call;
+        uint32_t length;
+        if (!read(&call, 2) || !read(&length, 4) || trace.size() - pos < length) return false;
+        const size_t next = pos + length;
+        if (call == static_cast<uint16_t>(Capture::Call::setTimeMatrix)) {
+            if (!readBuffer(timeMatrix) || !read(&timeMatrixSize, 4)) return false;
+        } else if (call == static_cast<uint16_t>(Capture::Call::generate)) {
+            Input input;
+            input.name = path + "#" + to_string(numCalls++);
+            if (!read(&input.numCourses, 4) || !read(&input.maxNumSchedules, 4) || !readBuffer(input.sectionLens) ||
+                !readBuffer(input.conflictCache) || !readBuffer(input.timeArray))
+                return false;
+            input.timeMatrix = timeMatrix;
+            input.timeMatrixSize = timeMatrixSize;
+            if (timeMatrixSize == 0) {
+                // the buildings of the meetings, which follow their start and end in the content of the time array
+                int numBuildings = 1;
+                for (size_t i = input.sectionLens.back() * 8 + 2; i < input.timeArray.size(); i += 3) {
+                    if (input.timeArray[i] != 65535) numBuildings = max(numBuildings, input.timeArray[i] + 1);
+                }
+                input.timeMatrixSize = numBuildings;
+                input.timeMatrix = syntheticTimeMatrix(numBuildings);
+            }
+            inputs.push_back(move(input));
+        }
+        pos = next;
+    }
+    return true;
+}
+
+/** generate frees its arguments, so it is given malloc'ed copies */
+template <typename T>
+T* copyOf(const vector<T>& vec) {
+    auto* ptr = static_cast<T*>(malloc(vec.size() * sizeof(T)));
+    memcpy(ptr, vec.data(), vec.size() * sizeof(T));
+    return ptr;
+}
+
+template <typename F>
+double timeMs(F&& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void clearCoeffCache() {
+    for (auto& cache : SG::sortCoeffCache) SG::freeCoeffCache(cache);
+}
+
+void sortAll(int mode) {
+    SG::setSortMode(mode);
+    for (int i = 0; i < NUM_METRICS; i++) SG::setSortOption(i, 1, 0, i, 1.0f);
+    SG::setSortOption(6, 0, 0, 6, 1.0f);
+    SG::sort();
+}
+
+Result run(const Input& input) {
+    Result result{};
+    result.generateMs = timeMs([&] {
+        result.count = SG::generate(input.numCourses, input.maxNumSchedules, copyOf(input.sectionLens),
+                                    copyOf(input.conflictCache), copyOf(input.timeArray));
+    });
+    if (result.count <= 0) return result;
+    result.addToEvalMs = timeMs([&] { SG::addToEval(input.timeArray.data(), input.sectionLens.data()); });
+
+    auto* ref = static_cast<uint16_t*>(malloc(input.numCourses * sizeof(uint16_t)));
+    memcpy(ref, SG::schedules, input.numCourses * sizeof(uint16_t));
+    SG::setRefSchedule(ref);
+    clearCoeffCache();
+    for (int i = 0; i < NUM_METRICS; i++) result.coeffMs[i] = timeMs([&] { SG::computeCoeffFor(i, false); });
+    // the coefficients are cached, so these only measure combining them and sorting
+    result.sortMs = timeMs([] { sortAll(SG::SortMode::combined); });
+    result.sortFallbackMs = timeMs([] { sortAll(SG::SortMode::fallback); });
+    return result;
+}
+
+/**
+ * reset the peak resident memory of the process to its current resident memory (Linux 4.0+)
+ */
+void resetPeakRSS() {
+    ofstream("/proc/self/clear_refs") << "5";
+}
+
+/**
+ * @returns the peak resident memory of the process in kilobytes, from /proc/self/status
+ */
+long peakRSS() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) return atol(line.c_str() + 6);
+    }
+    return 0;
+}
+
+double median(vector<double> values) {
+    sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+int main(int argc, char** argv) {
+    int courses = 0, sections = 8, meetings = 2, maxNumSchedules = 200000, runs = 5;
+    double conflicts = 0.1;
+    int threads = 0;
+    bool json = false;
+    vector<Input> inputs;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        auto next = [&] { return i + 1 < argc ? argv[++i] : "0"; };
+        if (arg == "--courses") courses = atoi(next());
+        else if (arg == "--sections") sections = atoi(next());
+        else if (arg == "--meetings") meetings = atoi(next());
+        else if (arg == "--conflicts") conflicts = atof(next());
+        else if (arg == "--max") maxNumSchedules = atoi(next());
+        else if (arg == "--runs") runs = max(atoi(next()), 1);
+        else if (arg == "--json") json = true;
+        else if (arg == "--threads") threads = atoi(next());
+        else if (!load(arg, inputs)) {
+            fprintf(stderr, "cannot read the trace %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (courses > 0) {
+        inputs.push_back(synthesize("custom", courses, sections, meetings, conflicts, maxNumSchedules));
+    } else if (inputs.empty()) {
+        inputs.push_back(synthesize("small", 5, 5, 2, 0.1, maxNumSchedules));
+        inputs.push_back(synthesize("typical", 7, 8, 2, 0.1, maxNumSchedules));
+        inputs.push_back(synthesize("large", 9, 10, 3, 0.05, maxNumSchedules * 5));
+        inputs.push_back(synthesize("dense", 8, 12, 3, 0.3, maxNumSchedules));
+    }
+
+    if (!json) {
+        printf("%-12s %10s %10s %12s %10s", "case", "schedules", "gen ms", "sched/s", "eval ms");
+        for (auto* name : metricNames) printf(" %11s", name);
+        printf(" %9s %9s %9s %9s\n", "sort ms", "fallback", "engine MB", "peak MB");
+    }
+    for (const auto& input : inputs) {
+        // the threads of the pool do not survive fork, so it is only started in the child
+        fflush(stdout);
+        const pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid > 0) {
+            int status;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) fprintf(stderr, "%s failed\n", input.name.c_str());
+            continue;
+        }
+#ifdef USE_THREADS
+        if (threads > 0) ThreadPool::pool().resize(threads);
+#endif
+        (void)threads;
+        auto* timeMatrix = new int[input.timeMatrix.size()];
+        memcpy(timeMatrix, input.timeMatrix.data(), input.timeMatrix.size() * sizeof(int));
+        SG::setTimeMatrix(timeMatrix, input.timeMatrixSize);
+        resetPeakRSS();
+        vector<Result> results;
+        for (int r = 0; r < runs; r++) results.push_back(run(input));
+        auto med = [&](auto field) {
+            vector<double> values;
+            for (auto& result : results) values.push_back(field(result));
+            return median(values);
+        };
+        const int count = results[0].count;
+        const double generateMs = med([](auto& r) { return r.generateMs; });
+        const double schedulesPerSec = count / (generateMs / 1000);
+        const double addToEvalMs = med([](auto& r) { return r.addToEvalMs; });
+        const double sortMs = med([](auto& r) { return r.sortMs; });
+        const double sortFallbackMs = med([](auto& r) { return r.sortFallbackMs; });
+        const double engineMB = Memory::memory.peakBytes / (1024.0 * 1024.0);
+        const double peakMB = peakRSS() / 1024.0;
+        if (json) {
+            printf("{\"case\":\"%s\",\"threads\":%d,\"schedules\":%d,\"generateMs\":%.3f,\"schedulesPerSec\":%.0f,\"addToEvalMs\":%.3f,\"coeffMs\":{",
+                   input.name.c_str(), ThreadPool::size(), count, generateMs, schedulesPerSec, addToEvalMs);
+            for (int i = 0; i < NUM_METRICS; i++)
+                printf("%s\"%s\":%.3f", i ? "," : "", metricNames[i], med([i](auto& r) { return r.coeffMs[i]; }));
+            printf("},\"sortMs\":%.3f,\"sortFallbackMs\":%.3f,\"engineMB\":%.1f,\"peakMB\":%.1f}\n", sortMs, sortFallbackMs, engineMB,
+                   peakMB);
+        } else {
+            printf("%-12s %10d %10.2f %12.0f %10.2f", input.name.c_str(), count, generateMs, schedulesPerSec, addToEvalMs);
+            for (int i = 0; i < NUM_METRICS; i++) printf(" %11.2f", med([i](auto& r) { return r.coeffMs[i]; }));
+            printf(" %9.2f %9.2f %9.1f %9.1f\n", sortMs, sortFallbackMs, engineMB, peakMB);
+        }
+        fflush(stdout);
+        _exit(0);
+    }
+}
@@ -0,0 +1,380 @@
+/**
+ * replay of a trace captured with setCapture (window.captureNative in the browser): `make replay && ./replay [--json] [--trace FILE] TRACE`
+ *
+ *   --json           print a JSON object instead of a table
+ *   --trace FILE     write the spans of the phases of the engines during the replay to FILE, as Chrome trace-event JSON
+ *
+ * The calls of the trace are made in order against the native library, with the arguments they had in the browser.
+ * The searchers created by the trace are mapped to the searchers created by the replay.
+ * The format of the trace is described in Capture.h
+ *
+ * Reported: the number of calls, and the total, mean and maximum time of the calls to each function.
+ * If the library is built with `make replay STATS=1`, the counters and phase timers of Stats.h are reported as well
+ */
+#include <algorithm>
+#include <cstddef>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Capture.h"
+#include "schedular.h"
+
+using namespace std;
+using Capture::Call;
+
+const char* const callNames[] = {
+    "result", "setOptions", "compute", "computeDays", "generate", "sort", "setSortMode", "setSortOption", "setTimeMatrix",
+    "setRefSchedule", "getSearcher", "getSearcherPacked", "getMultiFieldSearcher", "deleteSearcher", "sWSearch",
+    "findBestMatch", "substringSearch", "addSentences", "updateSentence", "removeSentence", "compactSearcher",
+    "setTypoTolerance", "setNumThreads", "setPoolSize",
+};
+constexpr int NUM_CALLS = sizeof(callNames) / sizeof(callNames[0]);
+
+#ifdef ENGINE_STATS
+#define STATS_FIELD(name) {#name, offsetof(EngineStats, name)}
+const pair<const char*, size_t> statsFields[] = {
+    STATS_FIELD(dfsNodes), STATS_FIELD(conflictChecks), STATS_FIELD(backtracks), STATS_FIELD(evalMoves),
+    STATS_FIELD(metricEvals), STATS_FIELD(lpProblems), STATS_FIELD(simplexCalls), STATS_FIELD(simplexIterations),
+    STATS_FIELD(tokensScored), STATS_FIELD(sentencesScored), STATS_FIELD(generateNs), STATS_FIELD(addToEvalNs),
+    STATS_FIELD(coeffNs), STATS_FIELD(sortNs), STATS_FIELD(renderNs), STATS_FIELD(simplexNs),
+    STATS_FIELD(searchBuildNs), STATS_FIELD(searchNs),
+};
+
+unsigned long long statValue(size_t offset) {
+    return *reinterpret_cast<const uint64_t*>(reinterpret_cast<const char*>(getStats()) + offset);
+}
+#endif
+
+struct CallStats {
+    int count = 0;
+    double totalUs = 0, maxUs = 0;
+};
+
+/** reads the arguments of a record in order */
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t size) : pos(data), end(data + size) {}
+
+    int i32() { return read<int32_t>(); }
+    float f32() { return read<float>(); }
+    double f64() { return read<double>(); }
+    uint64_t handle() { return read<uint64_t>(); }
+
+    /** a malloc'ed copy of a buffer argument, followed by a 0 so that strings are terminated */
+    template <typename T = char>
+    T* bytes() {
+        const uint32_t size = read<uint32_t>();
+        check(size);
+        auto* copy = static_cast<uint8_t*>(malloc(size + 1));
+        memcpy(copy, pos, size);
+        copy[size] = 0;
+        pos += size;
+        return reinterpret_cast<T*>(copy);
+    }
+
+private:
+    const uint8_t* pos;
+    const uint8_t* end;
+
+    void check(size_t size) {
+        if (static_cast<size_t>(end - pos) < size) {
+            fprintf(stderr, "truncated record\n");
+            exit(1);
+        }
+    }
+
+    template <typename T>
+    T read() {
+        check(sizeof(T));
+        T x;
+        memcpy(&x, pos, sizeof(T));
+        pos += sizeof(T);
+        return x;
+    }
+};
+
+int main(int argc, char** argv) {
+    string path, tracePath;
+    bool json = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--json") json = true;
+        else if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+        else path = arg;
+    }
+    ifstream file(path, ios::binary);
+    const vector<uint8_t> trace((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    uint32_t header[2];
+    if (trace.size() < sizeof(header)) {
+        fprintf(stderr, "cannot read %s\n", path.c_str());
+        return 1;
+    }
+    memcpy(header, trace.data(), sizeof(header));
+    if (header[0] != Capture::TRACE_MAGIC || header[1] > Capture::TRACE_VERSION) {
+        fprintf(stderr, "%s is not a trace of a supported version\n", path.c_str());
+        return 1;
+    }
+
+    if (!tracePath.empty()) setTracing(1);
+    // the searchers of the trace, by the handle they had in the browser
+    unordered_map<uint64_t, FastSearcher*> searchers;
+    FastSearcher* created = NULL;
+    CallStats calls[NUM_CALLS];
+    auto searcher = [&](Reader& args) {
+        auto it = searchers.find(args.handle());
+        if (it == searchers.end()) {
+            fprintf(stderr, "call to a searcher that was created before the capture started\n");
+            exit(1);
+        }
+        return it->second;
+    };
+
+    for (size_t pos = sizeof(header); pos < trace.size();) {
+        uint16_t id;
+        uint32_t length;
+        if (trace.size() - pos < 6) break;
+        memcpy(&id, &trace[pos], 2);
+        memcpy(&length, &trace[pos + 2], 4);
+        pos += 6;
+        if (trace.size() - pos < length) break;
+        Reader args(&trace[pos], length);
+        pos += length;
+
+        const auto call = static_cast<Call>(id);
+        if (call == Call::result) {
+            searchers[args.handle()] = created;
+            continue;
+        }
+        if (id >= NUM_CALLS) {
+            fprintf(stderr, "unknown call %d\n", id);
+            return 1;
+        }
+        // only the call itself is timed, not copying its arguments
+        auto start = chrono::steady_clock::now();
+        switch (call) {
+            case Call::setOptions: {
+                int opts[7];
+                for (int& opt : opts) opt = args.i32();
+                const double tFactor = args.f64();
+                start = chrono::steady_clock::now();
+                setOptions(opts[0], opts[1], opts[2], opts[3], opts[4], opts[5], opts[6], tFactor);
+                break;
+            }
+            case Call::compute: {
+                auto* arr = args.bytes<int16_t>();
+                const int N = args.i32();
+                start = chrono::steady_clock::now();
+                compute(arr, N);
+                break;
+            }
+            case Call::computeDays: {
+                auto* arr = args.bytes<int16_t>();
+                auto* dayLens = args.bytes<int>();
+                const int numDays = args.i32();
+                start = chrono::steady_clock::now();
+                computeDays(arr, dayLens, numDays);
+                break;
+            }
+            case Call::generate: {
+                const int numCourses = args.i32(), maxNumSchedules = args.i32();
+                auto* sectionLens = args.bytes<int>();
+                auto* conflictCache = args.bytes<uint8_t>();
+                auto* timeArray = args.bytes<uint16_t>();
+                start = chrono::steady_clock::now();
+                generate(numCourses, maxNumSchedules, sectionLens, conflictCache, timeArray);
+                break;
+            }
+            case Call::sort: sort(); break;
+            case Call::setSortMode: {
+                const int mode = args.i32();
+                start = chrono::steady_clock::now();
+                setSortMode(mode);
+                break;
+            }
+            case Call::setSortOption: {
+                const int i = args.i32(), enabled = args.i32(), reverse = args.i32(), idx = args.i32();
+                const float weight = args.f32();
+                start = chrono::steady_clock::now();
+                setSortOption(i, enabled, reverse, idx, weight);
+                break;
+            }
+            case Call::setTimeMatrix: {
+                // the time matrix is deleted with delete[]
+                auto* data = args.bytes<int>();
+                const int sideLen = args.i32();
+                auto* matrix = new int[sideLen * sideLen];
+                memcpy(matrix, data, sideLen * sideLen * sizeof(int));
+                free(data);
+                start = chrono::steady_clock::now();
+                setTimeMatrix(matrix, sideLen);
+                break;
+            }
+            case Call::setRefSchedule: {
+                auto* ref = args.bytes<uint16_t>();
+                start = chrono::steady_clock::now();
+                setRefSchedule(ref);
+                break;
+            }
+            case Call::getSearcher: {
+                const int N = args.i32();
+                auto** sentences = static_cast<const char**>(malloc(N * sizeof(char*)));
+                for (int i = 0; i < N; i++) sentences[i] = args.bytes();
+                start = chrono::steady_clock::now();
+                created = getSearcher(sentences, N);
+                break;
+            }
+            case Call::getSearcherPacked: {
+                auto* buffer = args.bytes();
+                auto* offsets = args.bytes<int>();
+                const int N = args.i32();
+                start = chrono::steady_clock::now();
+                created = getSearcherPacked(buffer, offsets, N);
+                break;
+            }
+            case Call::getMultiFieldSearcher: {
+                auto* buffer = args.bytes();
+                auto* offsets = args.bytes<int>();
+                const int numDocs = args.i32();
+                auto* weights = args.bytes<float>();
+                const int numFields = args.i32();
+                start = chrono::steady_clock::now();
+                created = getMultiFieldSearcher(buffer, offsets, numDocs, weights, numFields);
+                break;
+            }
+            case Call::deleteSearcher: {
+                const uint64_t handle = args.handle();
+                auto* s = searchers.at(handle);
+                searchers.erase(handle);
+                start = chrono::steady_clock::now();
+                deleteSearcher(s);
+                break;
+            }
+            case Call::sWSearch: {
+                auto* s = searcher(args);
+                auto* query = args.bytes();
+                const int numResults = args.i32(), gramLen = args.i32();
+                const float threshold = args.f32();
+                start = chrono::steady_clock::now();
+                sWSearch(s, query, numResults, gramLen, threshold);
+                break;
+            }
+            case Call::findBestMatch: {
+                auto* s = searcher(args);
+                auto* query = args.bytes();
+                start = chrono::steady_clock::now();
+                findBestMatch(s, query);
+                break;
+            }
+            case Call::substringSearch: {
+                auto* s = searcher(args);
+                auto* query = args.bytes();
+                const int maxResults = args.i32(), prefixOnly = args.i32();
+                start = chrono::steady_clock::now();
+                substringSearch(s, query, maxResults, prefixOnly);
+                break;
+            }
+            case Call::addSentences: {
+                auto* s = searcher(args);
+                auto* buffer = args.bytes();
+                auto* offsets = args.bytes<int>();
+                const int N = args.i32();
+                start = chrono::steady_clock::now();
+                addSentences(s, buffer, offsets, N);
+                break;
+            }
+            case Call::updateSentence: {
+                auto* s = searcher(args);
+                const int idx = args.i32();
+                auto* buffer = args.bytes();
+                auto* offsets = args.bytes<int>();
+                start = chrono::steady_clock::now();
+                updateSentence(s, idx, buffer, offsets);
+                break;
+            }
+            case Call::removeSentence: {
+                auto* s = searcher(args);
+                const int idx = args.i32();
+                start = chrono::steady_clock::now();
+                removeSentence(s, idx);
+                break;
+            }
+            case Call::compactSearcher: {
+                auto* s = searcher(args);
+                start = chrono::steady_clock::now();
+                compactSearcher(s);
+                break;
+            }
+            case Call::setTypoTolerance: {
+                auto* s = searcher(args);
+                const int maxDistance = args.i32();
+                const float weight = args.f32();
+                start = chrono::steady_clock::now();
+                setTypoTolerance(s, maxDistance, weight);
+                break;
+            }
+            case Call::setNumThreads: {
+                auto* s = searcher(args);
+                const int numThreads = args.i32();
+                start = chrono::steady_clock::now();
+                setNumThreads(s, numThreads);
+                break;
+            }
+            case Call::setPoolSize: {
+                const int numThreads = args.i32();
+                start = chrono::steady_clock::now();
+                setPoolSize(numThreads);
+                break;
+            }
+            default: break;
+        }
+        const double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        auto& s = calls[id];
+        s.count++;
+        s.totalUs += us;
+        s.maxUs = max(s.maxUs, us);
+    }
+
+    if (json) {
+        printf("{");
+        bool first = true;
+        for (int id = 1; id < NUM_CALLS; id++) {
+            auto& s = calls[id];
+            if (!s.count) continue;
+            printf("%s\"%s\":{\"count\":%d,\"totalMs\":%.3f,\"meanUs\":%.1f,\"maxUs\":%.1f}", first ? "" : ",", callNames[id],
+                   s.count, s.totalUs / 1000, s.totalUs / s.count, s.maxUs);
+            first = false;
+        }
+#ifdef ENGINE_STATS
+        printf("%s\"stats\":{", first ? "" : ",");
+        for (auto& [name, offset] : statsFields)
+            printf("%s\"%s\":%llu", offset ? "," : "", name, statValue(offset));
+        printf("}");
+#endif
+        printf("}\n");
+    } else {
+        printf("%-22s %8s %12s %12s %12s\n", "call", "count", "total ms", "mean us", "max us");
+        for (int id = 1; id < NUM_CALLS; id++) {
+            auto& s = calls[id];
+            if (!s.count) continue;
+            printf("%-22s %8d %12.2f %12.1f %12.1f\n", callNames[id], s.count, s.totalUs / 1000, s.totalUs / s.count, s.maxUs);
+        }
+#ifdef ENGINE_STATS
+        printf("\n");
+        for (auto& [name, offset] : statsFields) printf("%-22s %20llu\n", name, statValue(offset));
+#endif
+    }
+    if (!tracePath.empty()) {
+        setTracing(0);
+        const char* events = getTraceEvents();
+        ofstream(tracePath).write(events, getTraceEventsSize());
+    }
+    // searchers that the trace did not delete
+    for (auto& entry : searchers) deleteSearcher(entry.second);
+}
@@ -0,0 +1,264 @@
+/**
+ * benchmark of Searcher.cpp: `make bench-searcher && ./bench-searcher [options]`
+ *
+ *   --corpus FILE    the catalog to index, one course per line: title, a tab, and the description.
+ *                    Without it, a synthetic catalog of --docs courses is generated
+ *   --docs N         number of courses of the synthetic catalog
+ *   --queries FILE   the queries to type, one per line. Without it, queries are taken from the titles of the catalog,
+ *                    some of them with a typo
+ *   --runs N         number of times each query is typed
+ *   --threads N      the number of threads of the searcher (with USE_THREADS)
+ *   --json           print a JSON object instead of a table
+ *
+ * Each query is typed one key at a time, and each prefix that the app would search (at least 3 characters)
+ * is searched with sWSearch on a title/description searcher, configured as in Catalog.ts,
+ * and with findBestMatch on a title searcher. The result cache is cleared before each search.
+ *
+ * Reported: the time to build both searchers, the resident memory they take,
+ * and the p50/p99 latency of both searches for each query length
+ */
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+
+#include "../Searcher.cpp"
+
+namespace S = Searcher;
+
+/** the gram length, number of results and threshold used by Catalog.ts */
+constexpr int GRAM_LEN = 3;
+constexpr int NUM_RESULTS = 100;
+constexpr float THRESHOLD = 0.1f;
+/** queries of this many characters or more share a latency bucket */
+constexpr int MAX_BUCKET = 16;
+
+const char* const VOCABULARY[] = {
+    "introduction", "advanced", "topics", "in", "of", "and", "the", "to", "computer", "science", "data", "structures",
+    "algorithms", "systems", "programming", "theory", "analysis", "design", "history", "american", "european", "modern",
+    "literature", "writing", "physics", "chemistry", "organic", "biology", "molecular", "cell", "economics", "macro",
+    "micro", "statistics", "probability", "calculus", "linear", "algebra", "discrete", "mathematics", "engineering",
+    "electrical", "mechanical", "materials", "psychology", "social", "political", "philosophy", "ethics", "music",
+    "art", "architecture", "studio", "seminar", "research", "methods", "laboratory", "language", "spanish", "french",
+    "chinese", "japanese", "german", "culture", "society", "environmental", "policy", "public", "health", "medicine",
+    "neuroscience", "cognitive", "machine", "learning", "artificial", "intelligence", "networks", "security", "database",
+    "operating", "compilers", "graphics", "vision", "robotics", "signals", "circuits", "thermodynamics", "fluid",
+    "quantum", "mechanics", "astronomy", "geology", "anthropology", "sociology", "religious", "studies", "media",
+    "film", "theater", "dance", "finance", "accounting", "marketing", "management", "leadership", "law", "business",
+    "students", "course", "will", "this", "with", "for", "an", "on", "are", "including", "focus", "emphasis", "principles",
+};
+constexpr int VOCABULARY_SIZE = sizeof(VOCABULARY) / sizeof(VOCABULARY[0]);
+
+struct Course {
+    string title, description;
+};
+
+struct Latency {
+    vector<double> search, bestMatch;
+};
+
+/** words are drawn with a Zipf-like distribution, so that common words are much more frequent */
+string randomText(mt19937& rng, int minWords, int maxWords) {
+    string text;
+    const int numWords = minWords + rng() % (maxWords - minWords + 1);
+    for (int i = 0; i < numWords; i++) {
+        const double u = uniform_real_distribution<double>()(rng);
+        if (i) text += ' ';
+        text += VOCABULARY[min(static_cast<int>(VOCABULARY_SIZE * u * u), VOCABULARY_SIZE - 1)];
+    }
+    return text;
+}
+
+vector<Course> synthesizeCorpus(int numDocs) {
+    mt19937 rng(42);
+    vector<Course> corpus;
+    for (int i = 0; i < numDocs; i++) corpus.push_back({randomText(rng, 2, 6), randomText(rng, 30, 90)});
+    return corpus;
+}
+
+/** queries of 1 to 3 words of random titles. One in four has two adjacent characters swapped */
+vector<string> synthesizeQueries(const vector<Course>& corpus) {
+    mt19937 rng(7);
+    vector<string> queries;
+    for (int i = 0; i < 200; i++) {
+        vector<string_view> words;
+        S::split(corpus[rng() % corpus.size()].title.c_str(), words);
+        const int first = rng() % words.size(), last = min<int>(words.size(), first + 1 + rng() % 3);
+        string query;
+        for (int w = first; w < last; w++) {
+            if (w > first) query += ' ';
+            query += words[w];
+        }
+        if (i % 4 == 0 && query.size() > 4) {
+            const int pos = 1 + rng() % (query.size() - 2);
+            swap(query[pos], query[pos + 1]);
+        }
+        queries.push_back(query);
+    }
+    return queries;
+}
+
+vector<string> readLines(const string& path) {
+    ifstream file(path);
+    vector<string> lines;
+    for (string line; getline(file, line);) {
+        if (!line.empty()) lines.push_back(line);
+    }
+    return lines;
+}
+
+/** a malloc'ed copy, for the API functions that free their arguments */
+char* copyOf(const string& str) {
+    auto* ptr = static_cast<char*>(malloc(str.size() + 1));
+    memcpy(ptr, str.c_str(), str.size() + 1);
+    return ptr;
+}
+
+/** pack the strings in the format of getSearcherPacked */
+pair<char*, int*> pack(const vector<string>& strs) {
+    auto* offsets = static_cast<int*>(malloc((strs.size() + 1) * sizeof(int)));
+    offsets[0] = 0;
+    for (size_t i = 0; i < strs.size(); i++) offsets[i + 1] = offsets[i] + strs[i].size();
+    auto* buffer = static_cast<char*>(malloc(offsets[strs.size()] + 1));
+    for (size_t i = 0; i < strs.size(); i++) memcpy(buffer + offsets[i], strs[i].data(), strs[i].size());
+    return {buffer, offsets};
+}
+
+/** the resident memory of the process in MB */
+double residentMB() {
+    long pages = 0, resident = 0;
+    if (FILE* statm = fopen("/proc/self/statm", "r")) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(statm);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1048576.0);
+}
+
+template <typename F>
+double timeUs(F&& f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+double percentile(vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    sort(values.begin(), values.end());
+    return values[min(static_cast<size_t>(values.size() * p), values.size() - 1)];
+}
+
+/** the query as normalized by prepareQuery in Searcher.ts */
+string normalize(const string& query) {
+    string result;
+    for (char c : query) {
+        c = ispunct(static_cast<unsigned char>(c)) || isspace(static_cast<unsigned char>(c)) ? ' ' : tolower(c);
+        if (c != ' ' || (!result.empty() && result.back() != ' ')) result += c;
+    }
+    while (!result.empty() && result.back() == ' ') result.pop_back();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    string corpusPath, queriesPath;
+    int numDocs = 8000, runs = 3, numThreads = 1;
+    bool json = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        auto next = [&] { return i + 1 < argc ? argv[++i] : ""; };
+        if (arg == "--corpus") corpusPath = next();
+        else if (arg == "--docs") numDocs = max(atoi(next()), 1);
+        else if (arg == "--queries") queriesPath = next();
+        else if (arg == "--runs") runs = max(atoi(next()), 1);
+        else if (arg == "--threads") numThreads = max(atoi(next()), 1);
+        else if (arg == "--json") json = true;
+        else {
+            fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    vector<Course> corpus;
+    if (!corpusPath.empty()) {
+        for (auto& line : readLines(corpusPath)) {
+            const auto tab = line.find('\t');
+            corpus.push_back({line.substr(0, tab), tab == string::npos ? "" : line.substr(tab + 1)});
+        }
+    } else {
+        corpus = synthesizeCorpus(numDocs);
+    }
+    if (corpus.empty()) {
+        fprintf(stderr, "empty corpus\n");
+        return 1;
+    }
+    const auto queries = queriesPath.empty() ? synthesizeQueries(corpus) : readLines(queriesPath);
+
+    vector<string> fields, titles;
+    for (auto& course : corpus) {
+        fields.push_back(course.title);
+        fields.push_back(course.description);
+        titles.push_back(course.title);
+    }
+
+    const double memBefore = residentMB();
+    S::FastSearcher *searcher, *titleSearcher;
+    const double buildMs = timeUs([&] {
+        auto [buffer, offsets] = pack(fields);
+        auto* weights = static_cast<float*>(malloc(2 * sizeof(float)));
+        weights[0] = 1.0f;
+        weights[1] = 0.5f;
+        searcher = S::getMultiFieldSearcher(buffer, offsets, corpus.size(), weights, 2);
+        S::setTypoTolerance(searcher, 2, 0.8f);
+    }) / 1000;
+    const double titleBuildMs = timeUs([&] {
+        auto [buffer, offsets] = pack(titles);
+        titleSearcher = S::getSearcherPacked(buffer, offsets, titles.size());
+    }) / 1000;
+    const double memSearchers = residentMB() - memBefore;
+    S::setNumThreads(searcher, numThreads);
+
+    Latency latency[MAX_BUCKET + 1];
+    for (int r = 0; r < runs; r++) {
+        for (auto& query : queries) {
+            for (size_t len = 1; len <= query.size(); len++) {
+                const auto typed = normalize(query.substr(0, len));
+                if (typed.size() < GRAM_LEN) continue;
+                auto& bucket = latency[min<int>(typed.size(), MAX_BUCKET)];
+                S::clearResultCache(searcher);
+                bucket.search.push_back(timeUs([&] { S::sWSearch(searcher, copyOf(typed), NUM_RESULTS, GRAM_LEN, THRESHOLD); }));
+                bucket.bestMatch.push_back(timeUs([&] { S::findBestMatch(titleSearcher, copyOf(typed)); }));
+            }
+        }
+    }
+
+    if (json) {
+        printf("{\"docs\":%zu,\"queries\":%zu,\"threads\":%d,\"buildMs\":%.3f,\"titleBuildMs\":%.3f,\"memoryMB\":%.1f,\"latencyUs\":[",
+               corpus.size(), queries.size(), numThreads, buildMs, titleBuildMs, memSearchers);
+        bool first = true;
+        for (int len = GRAM_LEN; len <= MAX_BUCKET; len++) {
+            auto& bucket = latency[len];
+            if (bucket.search.empty()) continue;
+            printf("%s{\"length\":%d,\"count\":%zu,\"searchP50\":%.1f,\"searchP99\":%.1f,\"bestMatchP50\":%.1f,\"bestMatchP99\":%.1f}",
+                   first ? "" : ",", len, bucket.search.size(), percentile(bucket.search, 0.5), percentile(bucket.search, 0.99),
+                   percentile(bucket.bestMatch, 0.5), percentile(bucket.bestMatch, 0.99));
+            first = false;
+        }
+        printf("]}\n");
+    } else {
+        printf("%zu courses, %zu queries, %d threads\n", corpus.size(), queries.size(), numThreads);
+        printf("build: %.2f ms (title/description, with typo tolerance), %.2f ms (titles); memory: %.1f MB\n",
+               buildMs, titleBuildMs, memSearchers);
+        printf("%8s %8s %14s %14s %14s %14s\n", "length", "count", "sWSearch p50", "sWSearch p99", "best p50", "best p99");
+        for (int len = GRAM_LEN; len <= MAX_BUCKET; len++) {
+            auto& bucket = latency[len];
+            if (bucket.search.empty()) continue;
+            printf("%7d%s %8zu %11.1f us %11.1f us %11.1f us %11.1f us\n", len, len == MAX_BUCKET ? "+" : " ", bucket.search.size(),
+                   percentile(bucket.search, 0.5), percentile(bucket.search, 0.99),
+                   percentile(bucket.bestMatch, 0.5), percentile(bucket.bestMatch, 0.99));
+        }
+    }
+    S::deleteSearcher(searcher);
+    S::deleteSearcher(titleSearcher);
+}
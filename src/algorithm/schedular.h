@@ -0,0 +1,160 @@
+/**
+ * C API of the native builds of Renderer.cpp, ScheduleGenerator.cpp, Searcher.cpp, ThreadPool.cpp, Capture.cpp, Stats.cpp, Tracer.cpp and Memory.cpp (`make native`).
+ * These are the same functions that are exported to WebAssembly, see EMModule in src/main.ts.
+ * For the meaning of the parameters, refer to the cpp files.
+ *
+ * Arguments that are documented to be freed by a function must be allocated with malloc.
+ *
+ * libschedular.so only exports these functions with the prefix `schedular_`, e.g. `schedular_generate`, and hides all
+ * its other symbols, so that they do not collide with those of the host program. Define SCHEDULAR_SHARED before including
+ * this header to declare the prefixed names. The static library and the objects keep the names as they are
+ */
+
+#ifndef SCHEDULAR_H
+#define SCHEDULAR_H
+
+#include <stdint.h>
+
+#include "Memory.h"
+#include "Stats.h"
+
+#ifdef SCHEDULAR_SHARED
+#define SCHEDULAR_API(name) schedular_##name
+#else
+#define SCHEDULAR_API(name) name
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ------------ Renderer.cpp ---------------------------------------------- */
+
+typedef struct ScheduleBlock ScheduleBlock;
+
+void SCHEDULAR_API(setOptions)(int isTolerance, int ISMethod, int applyDFS,
+                               int dfsTolerance, int LPIters, int LPModel, int MILP, double tFactor);
+/**
+ * @param arr N pairs of (start, end) of the blocks, freed before this function returns
+ */
+ScheduleBlock* SCHEDULAR_API(compute)(const int16_t* arr, int N);
+/**
+ * @param arr the blocks of all days, concatenated, freed before this function returns
+ * @param dayLens the number of blocks of each day, freed before this function returns
+ */
+double* SCHEDULAR_API(computeDays)(const int16_t* arr, const int* dayLens, int numDays);
+double SCHEDULAR_API(getSum)(void);
+double SCHEDULAR_API(getSumSq)(void);
+
+/* ------------ ScheduleGenerator.cpp ------------------------------------- */
+
+/**
+ * @note sectionLens, conflictCache and timeArray are freed before this function returns
+ */
+int SCHEDULAR_API(generate)(int numCourses, int maxNumSchedules, const int* sectionLens, const uint8_t* conflictCache, const uint16_t* timeArray);
+void SCHEDULAR_API(sort)(void);
+void SCHEDULAR_API(setSortMode)(int mode);
+void SCHEDULAR_API(setSortOption)(int i, int enabled, int reverse, int idx, float weight);
+void SCHEDULAR_API(setTimeMatrix)(int* ptr, int sideLen);
+int SCHEDULAR_API(size)(void);
+uint16_t* SCHEDULAR_API(getSchedule)(int idx);
+float SCHEDULAR_API(getRange)(int idx);
+void SCHEDULAR_API(setRefSchedule)(uint16_t* ref);
+
+/* ------------ Searcher.cpp ---------------------------------------------- */
+
+typedef struct FastSearcher FastSearcher;
+typedef struct Dictionary Dictionary;
+
+/** a match [start, end) in a string */
+typedef struct {
+    int start, end;
+} SearchMatch;
+
+FastSearcher* SCHEDULAR_API(getSearcher)(const char** sentences, int N);
+FastSearcher* SCHEDULAR_API(getSearcherPacked)(char* buffer, const int* offsets, int N);
+FastSearcher* SCHEDULAR_API(getMultiFieldSearcher)(char* buffer, const int* offsets, int numDocs, const float* weights, int numFields);
+FastSearcher* SCHEDULAR_API(loadSearcher)(void* image, int length);
+void* SCHEDULAR_API(serializeSearcher)(FastSearcher* searcher);
+void SCHEDULAR_API(deleteSearcher)(FastSearcher* searcher);
+
+/**
+ * @note query strings are freed before these functions return
+ */
+int SCHEDULAR_API(findBestMatch)(FastSearcher* searcher, const char* query);
+int* SCHEDULAR_API(sWSearch)(FastSearcher* searcher, const char* query, int numResults, int gramLen, float threshold);
+int* SCHEDULAR_API(substringSearch)(FastSearcher* searcher, const char* query, int maxResults, int prefixOnly);
+
+int SCHEDULAR_API(getNumResults)(const FastSearcher* searcher);
+const SearchMatch* SCHEDULAR_API(getMatches)(const FastSearcher* searcher, int idx);
+int SCHEDULAR_API(getMatchSize)(const FastSearcher* searcher, int idx);
+float SCHEDULAR_API(getScore)(const FastSearcher* searcher, int idx);
+const SearchMatch* SCHEDULAR_API(getFieldMatches)(const FastSearcher* searcher, int idx, int field);
+int SCHEDULAR_API(getFieldMatchSize)(const FastSearcher* searcher, int idx, int field);
+float SCHEDULAR_API(getFieldScore)(const FastSearcher* searcher, int idx, int field);
+const int32_t* SCHEDULAR_API(getResultsPacked)(FastSearcher* searcher);
+
+void SCHEDULAR_API(addSentences)(FastSearcher* searcher, char* buffer, const int* offsets, int N);
+void SCHEDULAR_API(updateSentence)(FastSearcher* searcher, int idx, char* buffer, const int* offsets);
+void SCHEDULAR_API(removeSentence)(FastSearcher* searcher, int idx);
+void SCHEDULAR_API(compactSearcher)(FastSearcher* searcher);
+
+void SCHEDULAR_API(setTypoTolerance)(FastSearcher* searcher, int maxDistance, float weight);
+void SCHEDULAR_API(setNumThreads)(FastSearcher* searcher, int numThreads);
+
+Dictionary* SCHEDULAR_API(createDictionary)(void);
+void SCHEDULAR_API(releaseDictionary)(Dictionary* dict);
+void SCHEDULAR_API(attachDictionary)(FastSearcher* searcher, Dictionary* dict);
+
+/* ------------ ThreadPool.cpp --------------------------------------------- */
+
+void SCHEDULAR_API(setPoolSize)(int numThreads);
+int SCHEDULAR_API(getPoolSize)(void);
+
+/* ------------ Capture.cpp ------------------------------------------------ */
+
+/**
+ * start (nonzero) or stop capturing the calls to the functions above. The format of the trace is described in Capture.h,
+ * and it can be replayed with bench/replay.cpp
+ */
+void SCHEDULAR_API(setCapture)(int enabled);
+const uint8_t* SCHEDULAR_API(getCapture)(void);
+int SCHEDULAR_API(getCaptureSize)(void);
+
+/* ------------ Stats.cpp -------------------------------------------------- */
+
+/**
+ * the counters and phase timers of the engines. They are all 0 unless the library is built with `make native STATS=1`
+ */
+const EngineStats* SCHEDULAR_API(getStats)(void);
+void SCHEDULAR_API(resetStats)(void);
+
+/* ------------ Tracer.cpp ------------------------------------------------- */
+
+/**
+ * start (nonzero) or stop recording the spans of the phases of the engines, see Tracer.h
+ */
+void SCHEDULAR_API(setTracing)(int enabled);
+/**
+ * @returns the spans recorded so far as Chrome trace-event JSON, valid until the next call
+ */
+const char* SCHEDULAR_API(getTraceEvents)(void);
+int SCHEDULAR_API(getTraceEventsSize)(void);
+
+/* ------------ Memory.cpp ------------------------------------------------- */
+
+/**
+ * the memory used by the engines, by category, and their degraded modes, see Memory.h
+ */
+const EngineMemory* SCHEDULAR_API(getMemoryStats)(void);
+/**
+ * @param bytes the global memory budget of the engines, or 0 to remove it
+ */
+void SCHEDULAR_API(setMemoryBudget)(double bytes);
+void SCHEDULAR_API(resetMemoryPeak)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
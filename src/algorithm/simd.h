@@ -0,0 +1,69 @@
+/**
+ * a minimal layer over 128-bit SIMD intrinsics, used by the SIMD kernels of the engines.
+ * It maps to WebAssembly simd128 when compiled with -msimd128, and to the equivalent SSE2 intrinsics in native x86 builds,
+ * so that the same kernels can be tested natively. USE_SIMD is defined if either is available
+ */
+#pragma once
+
+#include <cstdint>
+
+#if defined(__wasm_simd128__)
+
+#include <wasm_simd128.h>
+#define USE_SIMD
+
+namespace simd {
+
+using f32x4 = v128_t;
+using i32x4 = v128_t;
+
+inline f32x4 load(const float* p) { return wasm_v128_load(p); }
+inline void store(float* p, f32x4 v) { wasm_v128_store(p, v); }
+inline f32x4 splat(float x) { return wasm_f32x4_splat(x); }
+inline f32x4 add(f32x4 a, f32x4 b) { return wasm_f32x4_add(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b) { return wasm_f32x4_sub(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b) { return wasm_f32x4_mul(a, b); }
+inline f32x4 min(f32x4 a, f32x4 b) { return wasm_f32x4_min(a, b); }
+inline f32x4 max(f32x4 a, f32x4 b) { return wasm_f32x4_max(a, b); }
+
+inline i32x4 loadInt(const void* p) { return wasm_v128_load(p); }
+inline i32x4 splatInt(uint32_t x) { return wasm_i32x4_splat(x); }
+/** bit i is set if lane i of a and b are equal */
+inline int eqMask(i32x4 a, i32x4 b) { return wasm_i32x4_bitmask(wasm_i32x4_eq(a, b)); }
+/** the number of equal lanes of 8 uint16_t at a and b */
+inline int countEq16(const uint16_t* a, const uint16_t* b) {
+    return __builtin_popcount(wasm_i16x8_bitmask(wasm_i16x8_eq(wasm_v128_load(a), wasm_v128_load(b))));
+}
+
+}  // namespace simd
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+#define USE_SIMD
+
+namespace simd {
+
+using f32x4 = __m128;
+using i32x4 = __m128i;
+
+inline f32x4 load(const float* p) { return _mm_loadu_ps(p); }
+inline void store(float* p, f32x4 v) { _mm_storeu_ps(p, v); }
+inline f32x4 splat(float x) { return _mm_set1_ps(x); }
+inline f32x4 add(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+inline f32x4 min(f32x4 a, f32x4 b) { return _mm_min_ps(a, b); }
+inline f32x4 max(f32x4 a, f32x4 b) { return _mm_max_ps(a, b); }
+
+inline i32x4 loadInt(const void* p) { return _mm_loadu_si128(static_cast<const __m128i*>(p)); }
+inline i32x4 splatInt(uint32_t x) { return _mm_set1_epi32(static_cast<int>(x)); }
+inline int eqMask(i32x4 a, i32x4 b) { return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))); }
+inline int countEq16(const uint16_t* a, const uint16_t* b) {
+    // two bits of the byte mask for each equal lane
+    return __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi16(loadInt(a), loadInt(b)))) / 2;
+}
+
+}  // namespace simd
+
+#endif
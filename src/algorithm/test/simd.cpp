@@ -0,0 +1,136 @@
+/**
+ * test of the SIMD kernels of simd.h against the scalar loops they replace: `make test-simd`.
+ * The kernels are compiled for SSE2, the native counterpart of WebAssembly simd128.
+ *
+ * Each kernel runs on random inputs whose lengths are not multiples of the vector width, with many ties and with ±0.
+ * The program prints the first mismatch and exits with 1 if there is any
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include "../ScheduleGenerator.cpp"
+#include "../Searcher.cpp"
+
+#ifndef USE_SIMD
+#error "the SIMD kernels are not compiled in: build with SSE2"
+#endif
+
+namespace SG = ScheduleGenerator;
+
+mt19937 rng(2020);
+int failures = 0;
+
+int randInt(int lo, int hi) {
+    return uniform_int_distribution<int>(lo, hi)(rng);
+}
+
+/** small integers, halves and ±0, so that there are many ties */
+float randCoeff() {
+    switch (randInt(0, 5)) {
+        case 0: return 0.0f;
+        case 1: return -0.0f;
+        case 2: return randInt(-3, 3) * 0.5f;
+        default: return uniform_real_distribution<float>(-100.0f, 100.0f)(rng);
+    }
+}
+
+void check(bool ok, const char* kernel, int n, int i) {
+    if (ok) return;
+    if (failures++ < 10) printf("%s: mismatch at %d of %d\n", kernel, i, n);
+}
+
+void testFindRange() {
+    for (int n = 1; n <= 67; n++) {
+        for (int run = 0; run < 20; run++) {
+            vector<float> arr(n);
+            for (auto& x : arr) x = randCoeff();
+            float min, max;
+            SG::findRange(arr.data(), n, min, max);
+            float refMin = INFINITY, refMax = -INFINITY;
+            for (float x : arr) {
+                if (x > refMax) refMax = x;
+                if (x < refMin) refMin = x;
+            }
+            // the lanes may keep either of +0 and -0, which compare equal and give the same range
+            check(min == refMin && max == refMax, "findRange", n, 0);
+        }
+    }
+}
+
+void testAddNormalizedSquares() {
+    for (int n = 0; n <= 67; n++) {
+        for (int run = 0; run < 20; run++) {
+            vector<float> coeff(n), acc(n);
+            for (auto& x : coeff) x = randCoeff();
+            for (auto& x : acc) x = randCoeff();
+            float min, max;
+            SG::findRange(coeff.data(), n, min, max);
+            const float ratio = max > min ? 1 / (max - min) : 1.0f;
+            const float weight = randInt(0, 1) ? 1.0f : uniform_real_distribution<float>(0.0f, 2.0f)(rng);
+            const bool reverse = randInt(0, 1);
+
+            vector<float> result = acc;
+            SG::count = n;
+            SG::coeffs = result.data();
+            SG::addNormalizedSquares(coeff.data(), min, max, ratio, weight, reverse);
+            for (int i = 0; i < n; i++) {
+                float val = (reverse ? max - coeff[i] : coeff[i] - min) * ratio;
+                float expected = acc[i] + weight * val * val;
+                // the same operations in the same order: the results are bit for bit equal
+                check(memcmp(&expected, &result[i], sizeof(float)) == 0, "addNormalizedSquares", n, i);
+            }
+        }
+    }
+    SG::count = 0;
+    SG::coeffs = NULL;
+}
+
+void testSimilarity() {
+    for (int numCourses = 1; numCourses <= 41; numCourses++) {
+        vector<uint16_t> ref(numCourses), schedules(numCourses * 16);
+        // few distinct sections, so that many of them are equal to the reference
+        for (auto& x : ref) x = randInt(0, 2);
+        for (auto& x : schedules) x = randInt(0, 2);
+        SG::numCourses = numCourses;
+        SG::refSchedule = ref.data();
+        SG::schedules = schedules.data();
+        for (int idx = 0; idx < 16; idx++) {
+            int expected = numCourses;
+            for (int j = 0; j < numCourses; j++) expected -= ref[j] == schedules[idx * numCourses + j];
+            check(SG::similarity(idx) == expected, "similarity", numCourses, idx);
+        }
+    }
+    SG::refSchedule = NULL;
+    SG::schedules = NULL;
+}
+
+void testFindIntGram() {
+    for (int n = 0; n <= 41; n++) {
+        for (int run = 0; run < 20; run++) {
+            vector<Gram> grams(n);
+            for (auto& g : grams) g = randInt(0, 3 * n + 3);
+            sort(grams.begin(), grams.end());
+            grams.erase(unique(grams.begin(), grams.end()), grams.end());
+            for (Gram key = 0; key <= static_cast<Gram>(3 * n + 4); key++) {
+                auto it = lower_bound(grams.begin(), grams.end(), key);
+                int expected = it != grams.end() && *it == key ? it - grams.begin() : -1;
+                check(Searcher::findIntGram(grams, key) == expected, "findIntGram", grams.size(), key);
+            }
+        }
+    }
+}
+
+int main() {
+    testFindRange();
+    testAddNormalizedSquares();
+    testSimilarity();
+    testFindIntGram();
+    if (failures) {
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    printf("all SIMD kernels match the scalar loops\n");
+    return 0;
+}
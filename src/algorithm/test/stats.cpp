@@ -0,0 +1,90 @@
+/**
+ * test of the counters and phase timers of Stats.h: `make test-stats`.
+ * The unit tests of the app load a wasm build without ENGINE_STATS, where all of them are 0, so they are checked here.
+ *
+ * A small generate, sort and sWSearch must count DFS nodes, metric evaluations and scored tokens.
+ * The program prints the counters that stayed 0 and exits with 1 if there is any
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../ScheduleGenerator.cpp"
+#include "../Searcher.cpp"
+#include "../Stats.cpp"
+
+#ifndef ENGINE_STATS
+#error "the counters are not compiled in: build with -DENGINE_STATS"
+#endif
+
+// the host reads the fields in order, see engineStatsFields in src/utils/other.ts
+static_assert(sizeof(EngineStats) == 18 * sizeof(uint64_t), "the fields of EngineStats are only appended");
+
+int failures = 0;
+
+template <typename T>
+T* copy(const T* data, int count) {
+    auto* result = static_cast<T*>(malloc(count * sizeof(T)));
+    memcpy(result, data, count * sizeof(T));
+    return result;
+}
+
+void expectCounted(const char* name, uint64_t value) {
+    if (value > 0) return;
+    printf("%s is 0\n", name);
+    failures++;
+}
+
+void testGenerator() {
+    // the inputs of the test in ScheduleGenerator.cpp: 2 courses of 2 sections
+    uint16_t timeArray[] = {
+        0, 0, 3, 3, 6, 6, 6, 6,
+        6, 6, 9, 9, 12, 12, 12, 12,
+        12, 12, 15, 15, 18, 18, 18, 18,
+        18, 18, 21, 21, 24, 24, 24, 24,
+        240, 300, (uint16_t)-1, 240, 300, (uint16_t)-1,
+        0, 60, (uint16_t)-1, 0, 60, (uint16_t)-1,
+        400, 460, (uint16_t)-1, 400, 460, (uint16_t)-1,
+        120, 180, (uint16_t)-1, 120, 180, (uint16_t)-1};
+    uint8_t conflict[16] = {0};
+    conflict[1] = 1;
+    conflict[2] = 1;
+    int secLens[3] = {0, 2, 4};
+    ScheduleGenerator::generate(2, 10, copy(secLens, 3), copy(conflict, 16),
+                                copy(timeArray, sizeof(timeArray) / sizeof(uint16_t)));
+    ScheduleGenerator::setSortOption(0, 1, 0, 0, 1.0f);
+    ScheduleGenerator::sort();
+
+    const auto* stats = getStats();
+    expectCounted("dfsNodes", stats->dfsNodes);
+    expectCounted("metricEvals", stats->metricEvals);
+    expectCounted("generateNs", stats->generateNs);
+    expectCounted("sortNs", stats->sortNs);
+}
+
+void testSearcher() {
+    const char text[] = "intro to data structuresorganic chemistry";
+    const int offsets[] = {0, 24, 41};
+    auto* searcher = Searcher::getSearcherPacked(copy(text, sizeof(text)), copy(offsets, 3), 2);
+    Searcher::sWSearch(searcher, strdup("data"), 2, 3, 0.1f);
+    Searcher::deleteSearcher(searcher);
+
+    const auto* stats = getStats();
+    expectCounted("tokensScored", stats->tokensScored);
+    expectCounted("sentencesScored", stats->sentencesScored);
+    expectCounted("searchBuildNs", stats->searchBuildNs);
+    expectCounted("searchNs", stats->searchNs);
+}
+
+int main() {
+    testGenerator();
+    testSearcher();
+    resetStats();
+    if (getStats()->dfsNodes != 0) {
+        printf("resetStats did not clear the counters\n");
+        failures++;
+    }
+    if (failures) return 1;
+    printf("all counters are counted\n");
+    return 0;
+}
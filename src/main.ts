@@ -10,7 +10,7 @@
 import Vue from 'vue';
 import ScheduleEvaluator from './algorithm/ScheduleEvaluator';
 import Catalog from './models/Catalog';
-import { highlightMatch } from './utils';
+import { highlightMatch, captureNative, getEngineStats, traceNative, getEngineMemory } from './utils';
 import { FastSearcher } from './algorithm/Searcher';
 import App from './App.vue';
 import axios from 'axios';
@@ -26,14 +26,17 @@ type Ptr = number;
 
 declare global {
     // ! for parameter meaning, refer to the cpp files in src/algorithm
+    // the APIs of Renderer.cpp are only in the renderer module (RendererModule), the others of the engines only in the core module (NativeModule)
     interface EMModule {
         _malloc(size: number): Ptr;
+        _free(ptr: Ptr): void;
 
         // ------------ APIs of Renderer.cpp --------------------------------------
         _setOptions(...a: number[]): void;
         _getSum(): number;
         _getSumSq(): number;
         _compute(a: Ptr, b: number): Ptr;
+        _computeDays(a: Ptr, dayLens: Ptr, numDays: number): Ptr;
         // ------------------------------------------------------------------------
 
         // ------------ APIs of ScheduleGenerator.cpp -----------------------------
@@ -50,15 +53,69 @@ declare global {
 
         // ------------ APIs of Searcher.cpp --------------------------------------
         _getSearcher(stringArr: Ptr, N: number): Ptr;
+        _getSearcherPacked(buffer: Ptr, offsets: Ptr, N: number): Ptr;
+        _getMultiFieldSearcher(
+            buffer: Ptr,
+            offsets: Ptr,
+            numDocs: number,
+            weights: Ptr,
+            numFields: number
+        ): Ptr;
         _sWSearch(a: Ptr, b: Ptr, c: number, d: number, e: number): Ptr;
         _getMatches(a: Ptr, b: number): Ptr;
         _getMatchSize(a: Ptr, b: number): number;
         _getScore(a: Ptr, b: number): number;
+        _getFieldMatches(a: Ptr, b: number, field: number): Ptr;
+        _getFieldMatchSize(a: Ptr, b: number, field: number): number;
+        _getFieldScore(a: Ptr, b: number, field: number): number;
         _findBestMatch(a: Ptr, b: Ptr): number;
+        _serializeSearcher(a: Ptr): Ptr;
+        _loadSearcher(image: Ptr, length: number): Ptr;
+        _setTypoTolerance(a: Ptr, maxDistance: number, weight: number): void;
+        _substringSearch(a: Ptr, query: Ptr, maxResults: number, prefixOnly: number): Ptr;
+        _getNumResults(a: Ptr): number;
+        _getResultsPacked(a: Ptr): Ptr;
+        _addSentences(a: Ptr, buffer: Ptr, offsets: Ptr, N: number): void;
+        _updateSentence(a: Ptr, idx: number, buffer: Ptr, offsets: Ptr): void;
+        _removeSentence(a: Ptr, idx: number): void;
+        _compactSearcher(a: Ptr): void;
+        _setNumThreads(a: Ptr, numThreads: number): void;
+        _createDictionary(): Ptr;
+        _releaseDictionary(dict: Ptr): void;
+        _attachDictionary(a: Ptr, dict: Ptr): void;
+        // ------------------------------------------------------------------------
+
+        // ------------ APIs of ThreadPool.cpp ------------------------------------
+        _setPoolSize(numThreads: number): void;
+        _getPoolSize(): number;
+        // ------------------------------------------------------------------------
+
+        // ------------ APIs of Capture.cpp ---------------------------------------
+        _setCapture(enabled: number): void;
+        _getCapture(): Ptr;
+        _getCaptureSize(): number;
+        // ------------------------------------------------------------------------
+
+        // ------------ APIs of Stats.cpp -----------------------------------------
+        _getStats(): Ptr;
+        _resetStats(): void;
+        // ------------------------------------------------------------------------
+
+        // ------------ APIs of Tracer.cpp ----------------------------------------
+        _setTracing(enabled: number): void;
+        _getTraceEvents(): Ptr;
+        _getTraceEventsSize(): number;
+        // ------------------------------------------------------------------------
+
+        // ------------ APIs of Memory.cpp ----------------------------------------
+        _getMemoryStats(): Ptr;
+        _setMemoryBudget(bytes: number): void;
+        _resetMemoryPeak(): void;
         // ------------------------------------------------------------------------
 
         onRuntimeInitialized(): void;
         stringToUTF8(str: string, outPtr: Ptr, maxBytesToWrite: number): void;
+        lengthBytesUTF8(str: string): number;
         HEAP8: Int8Array;
         HEAP16: Int16Array;
         HEAP32: Int32Array;
@@ -76,8 +133,17 @@ declare global {
         buildingSearcher: FastSearcher<string>;
         watchers: WatchFactory;
         saveStatus: typeof saveStatus;
+        captureNative: typeof captureNative;
+        getEngineStats: typeof getEngineStats;
+        traceNative: typeof traceNative;
+        getEngineMemory: typeof getEngineMemory;
         NativeModule: EMModule;
         GetNative(): Promise<EMModule>;
+        /** loaded on demand by loadRenderer in src/algorithm/Renderer.ts */
+        RendererModule?: EMModule;
+        GetRenderer?(): Promise<EMModule>;
+        /** the suffix of the variant of the wasm modules that the browser supports, set in public/index.html */
+        wasmVariant: string;
     }
 
     // copied from https://www.typescriptlang.org/docs/handbook/advanced-types.html
@@ -109,6 +175,11 @@ Vue.prototype.highlightMatch = highlightMatch;
 Vue.prototype.formatLocationURL = formatLocationURL;
 
 window.saveStatus = saveStatus;
+// call from the console to capture, count or trace the calls to the native module, or to inspect its memory
+window.captureNative = captureNative;
+window.getEngineStats = getEngineStats;
+window.traceNative = traceNative;
+window.getEngineMemory = getEngineMemory;
 window.watchers = new WatchFactory();
 
 new Vue({
@@ -11,7 +11,12 @@
 import Course, { Match } from './Course';
 import Schedule from './Schedule';
 import Section, { SectionMatch } from './Section';
-import { FastSearcher, SearchResult } from '@/algorithm/Searcher';
+import {
+    MultiFieldSearcher,
+    MultiFieldSearchResult,
+    SearchDictionary,
+    SearchResult
+} from '@/algorithm/Searcher';
 /**
  * represents a semester
  */
@@ -42,8 +47,25 @@ export type SearchMatch = [Match<'key' | 'title' | 'description'>[], Map<number,
  * 3. number of distinct sections
  */
 type ScoreEntry = [number, number, number];
-type CourseSearchResult = SearchResult<Course, 'title' | 'description'>;
-type SectionSearchResult = SearchResult<Section, 'topic' | 'instructors'>;
+type CourseField = 'title' | 'description';
+type SectionField = 'topic' | 'instructors';
+type CourseSearchResult = SearchResult<unknown, CourseField>;
+type SectionSearchResult = SearchResult<unknown, SectionField>;
+
+/**
+ * weight of each field in the score of a course/section
+ */
+const fieldWeights = {
+    title: 1,
+    description: 0.5,
+    topic: 0.9,
+    instructors: 0.25
+};
+
+/**
+ * the token dictionary shared by the searchers of all catalogs, created with the first catalog
+ */
+let dictionary: SearchDictionary | undefined;
 
 const courseMap = new Map<string, CourseSearchResult[]>();
 const sectionMap = new Map<string, Map<number, SectionSearchResult[]>>();
@@ -89,10 +111,8 @@ export default class Catalog {
      */
     private readonly sectionMap: Map<number, Section>;
 
-    private titleSearcher: FastSearcher<Course, 'title'>;
-    private descriptionSearcher: FastSearcher<Course, 'description'>;
-    private topicSearcher: FastSearcher<Section, 'topic'>;
-    private instrSearcher: FastSearcher<Section, 'instructors'>;
+    private courseSearcher: MultiFieldSearcher<Course, CourseField>;
+    private sectionSearcher: MultiFieldSearcher<Section, SectionField>;
     /**
      * @param semester the semester corresponding to the catalog stored in this object
      * @param data
@@ -109,18 +129,23 @@ export default class Catalog {
         for (const sec of this.sections) {
             this.sectionMap.set(sec.id, sec);
         }
-        this.titleSearcher = new FastSearcher(this.courses, obj => obj.title, 'title');
-        this.descriptionSearcher = new FastSearcher(
-            this.courses,
-            obj => obj.description,
-            'description'
-        );
-        this.topicSearcher = new FastSearcher(this.sections, obj => obj.topic, 'topic');
-        this.instrSearcher = new FastSearcher(
-            this.sections,
-            obj => obj.instructors.join(' '),
-            'instructors'
-        );
+        this.courseSearcher = new MultiFieldSearcher(this.courses, [
+            { name: 'title', weight: fieldWeights.title, toStr: obj => obj.title },
+            { name: 'description', weight: fieldWeights.description, toStr: obj => obj.description }
+        ]);
+        this.sectionSearcher = new MultiFieldSearcher(this.sections, [
+            { name: 'topic', weight: fieldWeights.topic, toStr: obj => obj.topic },
+            {
+                name: 'instructors',
+                weight: fieldWeights.instructors,
+                toStr: obj => obj.instructors.join(' ')
+            }
+        ]);
+        this.courseSearcher.setTypoTolerance();
+        this.sectionSearcher.setTypoTolerance();
+        dictionary = dictionary || new SearchDictionary();
+        this.courseSearcher.attachDictionary(dictionary);
+        this.sectionSearcher.attachDictionary(dictionary);
         console.timeEnd('catalog prep');
     }
 
@@ -168,48 +193,52 @@ export default class Catalog {
         }
     }
 
-    private processCourseResults(results: CourseSearchResult[], weight: number) {
-        for (const result of results) {
-            const { key } = this.courses[result.index];
-            const score = result.score ** 2 * weight;
+    private processCourseResults(results: MultiFieldSearchResult<CourseField>[]) {
+        for (const { fields } of results) {
+            for (const result of fields) {
+                const { key } = this.courses[result.index];
+                const score = result.score ** 2 * fieldWeights[result.data];
 
-            const temp = courseMap.get(key);
-            if (temp) {
-                scores.get(key)![0] += score;
-                temp.push(result);
-            } else {
-                // if encounter this course for the first time
-                scores.set(key, [score, 0, 0]);
-                courseMap.set(key, [result]);
+                const temp = courseMap.get(key);
+                if (temp) {
+                    scores.get(key)![0] += score;
+                    temp.push(result);
+                } else {
+                    // if encounter this course for the first time
+                    scores.set(key, [score, 0, 0]);
+                    courseMap.set(key, [result]);
+                }
             }
         }
     }
 
-    private processSectionResults(results: SectionSearchResult[], weight: number) {
-        for (const result of results) {
-            const { key, id } = this.sections[result.index];
-            const score = result.score ** 2 * weight;
-
-            let scoreEntry = scores.get(key);
-            if (!scoreEntry) {
-                scoreEntry = [0, 0, 0];
-                scores.set(key, scoreEntry);
-            }
-            scoreEntry[1] += score;
+    private processSectionResults(results: MultiFieldSearchResult<SectionField>[]) {
+        for (const { fields } of results) {
+            for (const result of fields) {
+                const { key, id } = this.sections[result.index];
+                const score = result.score ** 2 * fieldWeights[result.data];
 
-            const secMatches = sectionMap.get(key);
-            if (secMatches) {
-                const matches = secMatches.get(id);
-                if (matches) {
-                    matches.push(result);
+                let scoreEntry = scores.get(key);
+                if (!scoreEntry) {
+                    scoreEntry = [0, 0, 0];
+                    scores.set(key, scoreEntry);
+                }
+                scoreEntry[1] += score;
+
+                const secMatches = sectionMap.get(key);
+                if (secMatches) {
+                    const matches = secMatches.get(id);
+                    if (matches) {
+                        matches.push(result);
+                    } else {
+                        secMatches.set(id, [result]);
+                        // if encounter a new section of a course, increment the number of section recorded
+                        scoreEntry[2] += 1;
+                    }
                 } else {
-                    secMatches.set(id, [result]);
-                    // if encounter a new section of a course, increment the number of section recorded
+                    sectionMap.set(key, new Map().set(id, [result]));
                     scoreEntry[2] += 1;
                 }
-            } else {
-                sectionMap.set(key, new Map().set(id, [result]));
-                scoreEntry[2] += 1;
             }
         }
     }
@@ -219,10 +248,9 @@ export default class Catalog {
      */
     public fuzzySearch(query: string) {
         console.time('search');
-        this.processCourseResults(this.titleSearcher!.sWSearch(query, 50), 1);
-        this.processCourseResults(this.descriptionSearcher!.sWSearch(query, 50), 0.5);
-        this.processSectionResults(this.topicSearcher!.sWSearch(query, 50), 0.9);
-        this.processSectionResults(this.instrSearcher!.sWSearch(query, 50), 0.25);
+        // all fields of courses/sections are searched in a single pass
+        this.processCourseResults(this.courseSearcher.sWSearch(query, 100));
+        this.processSectionResults(this.sectionSearcher.sWSearch(query, 100));
 
         // sort courses in descending order; section score is normalized before added to course score
         const scoreEntries = Array.from(scores)
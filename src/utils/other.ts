@@ -104,6 +104,175 @@ export function savePlain(str: string, filename: string) {
     saveAs(new Blob([str], { type: 'text/plain;charset=utf-8' }), filename);
 }
 
+/**
+ * the native modules that are loaded: the core module, and the renderer module once it is loaded.
+ * Each has its own capture, counters, trace and memory accounting
+ */
+function nativeModules() {
+    const modules = [window.NativeModule];
+    if (window.RendererModule) modules.push(window.RendererModule);
+    return modules;
+}
+
+/**
+ * start or stop capturing the calls to the native modules. When stopped, the captured traces are saved as files,
+ * one per module, which can be replayed natively with src/algorithm/bench/replay.cpp
+ * @param enabled whether to start or stop
+ */
+export function captureNative(enabled: boolean) {
+    nativeModules().forEach((Module, i) => {
+        if (!enabled) {
+            const ptr = Module._getCapture();
+            const trace = Module.HEAPU8.slice(ptr, ptr + Module._getCaptureSize());
+            const filename = i ? 'capture-renderer.strc' : 'capture.strc';
+            if (trace.length) saveAs(new Blob([trace], { type: 'application/octet-stream' }), filename);
+        }
+        Module._setCapture(+enabled);
+    });
+}
+
+/**
+ * start or stop recording the phases of the native modules on a timeline. When stopped, the timeline is saved as
+ * Chrome trace-event JSON, which can be opened in about:tracing or https://ui.perfetto.dev.
+ * The spans of each module are shown as a separate process
+ * @param enabled whether to start or stop
+ */
+export function traceNative(enabled: boolean) {
+    const modules = nativeModules();
+    if (!enabled) {
+        const traceEvents: { pid: number }[] = [];
+        modules.forEach((Module, i) => {
+            Module._setTracing(0);
+            const ptr = Module._getTraceEvents();
+            const json = new TextDecoder().decode(Module.HEAPU8.slice(ptr, ptr + Module._getTraceEventsSize()));
+            for (const event of JSON.parse(json).traceEvents) traceEvents.push({ ...event, pid: i + 1 });
+        });
+        const json = JSON.stringify({ displayTimeUnit: 'ms', traceEvents });
+        saveAs(new Blob([json], { type: 'application/json' }), 'trace.json');
+    } else {
+        for (const Module of modules) Module._setTracing(1);
+    }
+}
+
+/**
+ * the fields of EngineStats in src/algorithm/Stats.h, in order
+ */
+const engineStatsFields = [
+    'dfsNodes',
+    'conflictChecks',
+    'backtracks',
+    'evalMoves',
+    'metricEvals',
+    'lpProblems',
+    'simplexCalls',
+    'simplexIterations',
+    'tokensScored',
+    'sentencesScored',
+    'generateNs',
+    'addToEvalNs',
+    'coeffNs',
+    'sortNs',
+    'renderNs',
+    'simplexNs',
+    'searchBuildNs',
+    'searchNs'
+] as const;
+
+/**
+ * read the counters and phase timers of the native modules, summed. They are all 0 unless they are built with `make dev STATS=1`
+ * @param reset whether to reset them after they are read
+ */
+export function getEngineStats(reset = false) {
+    const stats = {} as Record<typeof engineStatsFields[number], number>;
+    for (const field of engineStatsFields) stats[field] = 0;
+    for (const Module of nativeModules()) {
+        // each field is a uint64: the low and the high 32 bits
+        const base = Module._getStats() / 4;
+        engineStatsFields.forEach((field, i) => {
+            stats[field] += Module.HEAPU32[base + i * 2] + Module.HEAPU32[base + i * 2 + 1] * 2 ** 32;
+        });
+        if (reset) Module._resetStats();
+    }
+    return stats;
+}
+
+/**
+ * the categories of MemoryCategory in src/algorithm/Memory.h, in order
+ */
+const engineMemoryCategories = [
+    'schedules',
+    'eval',
+    'sortCoeffs',
+    'renderBlocks',
+    'searchIndex',
+    'searchQuery',
+    'searchCache'
+] as const;
+
+/**
+ * the share of the memory budget given to the renderer module once it is loaded. The core module gets the rest
+ */
+const rendererBudgetShare = 0.25;
+/**
+ * the memory budget of the native modules together, in bytes. 0 if there is none
+ */
+let memoryBudget = 0;
+
+/**
+ * split the memory budget between the native modules that are loaded. Called again when the renderer module is loaded
+ */
+export function applyMemoryBudget() {
+    const renderer = window.RendererModule;
+    // each module must get at least 1 byte of a budget, because 0 removes it
+    const rendererBudget = renderer && memoryBudget ? Math.max(Math.floor(memoryBudget * rendererBudgetShare), 1) : 0;
+    window.NativeModule._setMemoryBudget(memoryBudget && Math.max(memoryBudget - rendererBudget, 1));
+    if (renderer) renderer._setMemoryBudget(rendererBudget);
+}
+
+/**
+ * read the memory used by the native modules, in bytes, and the degraded modes that they entered because of the budget.
+ * The figures of the modules are summed, including their budgets
+ * @param budget if given, set the memory budget of the modules together in bytes (0 to remove it) after reading.
+ * It is split between them, see [[applyMemoryBudget]]
+ * @param reset whether to reset the peaks and the degraded modes after reading
+ */
+export function getEngineMemory(budget?: number, reset = false) {
+    const numCategories = engineMemoryCategories.length;
+    const categories = {} as Record<typeof engineMemoryCategories[number], { current: number; peak: number }>;
+    for (const category of engineMemoryCategories) categories[category] = { current: 0, peak: 0 };
+    const memory = {
+        current: 0,
+        peak: 0,
+        budget: 0,
+        fewerSchedules: false,
+        evictedCoeffs: false,
+        uncachedResults: false,
+        categories
+    };
+    for (const Module of nativeModules()) {
+        // each field is an int64: the low and the high 32 bits. The sizes are far below 2^53
+        const base = Module._getMemoryStats() / 4;
+        const read = (i: number) => Module.HEAPU32[base + i * 2] + Module.HEAP32[base + i * 2 + 1] * 2 ** 32;
+        engineMemoryCategories.forEach((category, i) => {
+            categories[category].current += read(4 + i);
+            categories[category].peak += read(4 + numCategories + i);
+        });
+        const degraded = read(3);
+        memory.current += read(0);
+        memory.peak += read(1);
+        memory.budget += read(2);
+        memory.fewerSchedules = memory.fewerSchedules || !!(degraded & 1);
+        memory.evictedCoeffs = memory.evictedCoeffs || !!(degraded & 2);
+        memory.uncachedResults = memory.uncachedResults || !!(degraded & 4);
+        if (reset) Module._resetMemoryPeak();
+    }
+    if (budget !== undefined) {
+        memoryBudget = budget;
+        applyMemoryBudget();
+    }
+    return memory;
+}
+
 /**
  * convert an (axios request) error to string message
  * @param err
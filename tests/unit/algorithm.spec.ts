@@ -1,7 +1,9 @@
 import Schedule from '@/models/Schedule';
 import Store from '@/store';
 import ProposedSchedule from '@/models/ProposedSchedule';
-import { FastSearcher } from '@/algorithm/Searcher';
+import { FastSearcher, MultiFieldSearcher, SearchDictionary } from '@/algorithm/Searcher';
+import { getEngineStats, getEngineMemory } from '@/utils';
+import { loadRenderer } from '@/algorithm/Renderer';
 
 const store = new Store();
 
@@ -103,9 +105,199 @@ describe('ScheduleGenerator Test', () => {
         expect(r).toBeTruthy();
     });
 
+    it('searcher non-ASCII capitals', () => {
+        const searcher = new FastSearcher(['Introducción al Álgebra', 'Über Kafka', 'organic chemistry']);
+        expect(searcher.sWSearch('álgebra', 1)[0].index).toBe(0);
+        expect(searcher.sWSearch('ÁLGEBRA', 1)[0].index).toBe(0);
+        expect(searcher.sWSearch('über', 1)[0].index).toBe(1);
+        expect(searcher.substringSearch('ÜBER', 3).map(r => r.index)).toEqual([1]);
+
+        // the matches are indices of the original strings, not byte offsets of their UTF-8 encoding
+        expect(Array.from(searcher.sWSearch('álgebra', 1)[0].matches)).toEqual([16, 23]);
+        expect(Array.from(searcher.substringSearch('über', 3)[0].matches)).toEqual([0, 4]);
+        const multi = new MultiFieldSearcher(
+            [{ title: 'Über Kafka', desc: 'Introducción al Álgebra' }],
+            [
+                { name: 'title', weight: 1, toStr: x => x.title },
+                { name: 'desc', weight: 0.5, toStr: x => x.desc }
+            ]
+        );
+        const [result] = multi.sWSearch('álgebra', 1);
+        expect(result.fields.map(f => f.data)).toEqual(['desc']);
+        expect(Array.from(result.fields[0].matches)).toEqual([16, 23]);
+    });
+
     it('searcher', () => {
         const searcher = new FastSearcher(['building number 1', 'a great building']);
         const [idx] = searcher.findBestMatch('build num 1');
         expect(idx).toBe(0);
     });
+
+    it('searcher image', () => {
+        const items = ['building number 1', 'a great building'];
+        const searcher = new FastSearcher(items);
+        const loaded = new FastSearcher(items, undefined, '', searcher.serialize());
+        expect(loaded.sWSearch('great build', 2)).toEqual(searcher.sWSearch('great build', 2));
+    });
+
+    it('searcher result cache', () => {
+        const searcher = new FastSearcher(['building number 1', 'a great building']);
+        const scores = searcher.sWSearch('great build', 2).map(r => [r.index, r.score]);
+        searcher.sWSearch('number', 2);
+        // restored from the result cache
+        expect(searcher.sWSearch('great build', 2).map(r => [r.index, r.score])).toEqual(scores);
+
+        // backspace, then type again: the query after the cached one extends its restored state
+        searcher.sWSearch('great buil', 2);
+        searcher.sWSearch('great build', 2);
+        const fresh = new FastSearcher(['building number 1', 'a great building']);
+        expect(searcher.sWSearch('great buildi', 2)).toEqual(fresh.sWSearch('great buildi', 2));
+    });
+
+    it('searcher typo tolerance', () => {
+        const searcher = new FastSearcher(['building number 1', 'a great building']);
+        expect(searcher.sWSearch('nubmer', 1)[0].score).toBe(0);
+        searcher.setTypoTolerance(2, 1);
+        const [result] = searcher.sWSearch('nubmer', 1);
+        expect(result.index).toBe(0);
+        expect(Array.from(result.matches)).toEqual([9, 15]);
+    });
+
+    it('searcher substring search', () => {
+        const searcher = new FastSearcher(['building number 1', 'a great building']);
+        const results = searcher.substringSearch('build', 5);
+        expect(results.map(r => r.index)).toEqual([0, 1]);
+        expect(Array.from(results[1].matches)).toEqual([8, 13]);
+        expect(searcher.substringSearch('uild', 5, true)).toEqual([]);
+    });
+
+    it('searcher mutation', () => {
+        const searcher = new FastSearcher(['building number 1', 'a great building']);
+        searcher.addItems(['small house']);
+        searcher.updateItem(0, 'large house');
+        searcher.removeItem(1);
+        const houses = searcher.sWSearch('house', 3);
+        expect(houses.filter(r => r.score > 0).map(r => r.index).sort()).toEqual([0, 2]);
+        expect(searcher.sWSearch('great', 1)[0].score).toBe(0);
+    });
+
+    it('invalid searcher image', () => {
+        const items = ['building number 1', 'a great building'];
+        const expected = new FastSearcher(items).sWSearch('great build', 2);
+        const image = new FastSearcher(items).serialize();
+        // truncated, stale and corrupted images are rejected, and the index is built from the items instead
+        const truncated = new FastSearcher(items, undefined, '', image.slice(0, image.length - 4));
+        expect(truncated.sWSearch('great build', 2)).toEqual(expected);
+        const stale = new FastSearcher([...items, 'small house'], undefined, '', image);
+        expect(stale.sWSearch('great build', 2).map(r => r.index)).toEqual(expected.map(r => r.index));
+        const corrupted = image.slice();
+        new DataView(corrupted.buffer).setInt32(16, 0, true);
+        expect(new FastSearcher(items, undefined, '', corrupted).sWSearch('great build', 2)).toEqual(expected);
+    });
+
+    it('searcher phrase bonus', () => {
+        const searcher = new FastSearcher(['structures of data analysis', 'structures data', 'data structures']);
+        const results = searcher.sWSearch('data structures', 3);
+        expect(results.map(r => r.index)).toEqual([2, 1, 0]);
+
+        // the windows of "dat structures data" that contain "data" do not contain the phrase "dat structures"
+        const scores = new FastSearcher(['dat structures data', 'structures data']).sWSearch('data structures', 2);
+        const [first, second] = scores.sort((a, b) => a.index - b.index);
+        expect(first.score).toBeCloseTo(second.score);
+    });
+
+    it('multi-field searcher', () => {
+        const items = [
+            { title: 'Data Structures', desc: 'trees and graphs' },
+            { title: 'Graph Theory', desc: 'data structures for graphs' }
+        ];
+        const searcher = new MultiFieldSearcher(items, [
+            { name: 'title', weight: 1, toStr: x => x.title },
+            { name: 'desc', weight: 0.5, toStr: x => x.desc }
+        ]);
+        const results = searcher.sWSearch('data structures', 2);
+        expect(results[0].index).toBe(0);
+        expect(results[0].fields[0].data).toBe('title');
+        expect(results[1].fields.map(f => f.data)).toEqual(['desc']);
+        expect(results[1].score).toBeCloseTo(results[1].fields[0].score * 0.5);
+    });
+
+    it('shared dictionary', () => {
+        const items = ['intro to data structures', 'organic chemistry', 'data analysis'];
+        const standalone = new FastSearcher(items).sWSearch('data struct', 3);
+
+        const dict = new SearchDictionary();
+        const searcher = new FastSearcher(items);
+        const other = new FastSearcher(['structures of data', 'chemistry lab']);
+        searcher.attachDictionary(dict);
+        other.attachDictionary(dict);
+        dict.release();
+        other.sWSearch('data', 2);
+        expect(searcher.sWSearch('data struct', 3)).toEqual(standalone);
+
+        // the image of an attached searcher is the same as that of a standalone one
+        const loaded = new FastSearcher(items, undefined, '', searcher.serialize());
+        expect(loaded.sWSearch('data struct', 3)).toEqual(standalone);
+        expect(searcher.sWSearch('data struct', 3)).toEqual(standalone);
+    });
+
+    it('capture', () => {
+        const Module = window.NativeModule;
+        Module._setCapture(1);
+        new FastSearcher(['intro to data structures']).sWSearch('data', 1);
+        const ptr = Module._getCapture();
+        const header = new Uint32Array(Module.HEAPU8.slice(ptr, ptr + 8).buffer);
+        expect(header[0]).toBe(0x43525453);
+        expect(Module._getCaptureSize()).toBeGreaterThan(8);
+        Module._setCapture(0);
+        expect(Module._getCaptureSize()).toBe(0);
+    });
+
+    it('engine stats', () => {
+        // the modules loaded here are built without STATS=1, so all counters are 0. Only the layout is checked:
+        // the counters themselves are tested natively by `make test-stats`
+        const stats = getEngineStats(true);
+        expect(Object.keys(stats)).toHaveLength(18);
+        expect(Object.keys(stats).slice(-2)).toEqual(['searchBuildNs', 'searchNs']);
+    });
+
+    it('trace events', () => {
+        const Module = window.NativeModule;
+        Module._setTracing(1);
+        new FastSearcher(['intro to data structures']).sWSearch('data', 1);
+        Module._setTracing(0);
+        const ptr = Module._getTraceEvents();
+        const json = String.fromCharCode(...Module.HEAPU8.slice(ptr, ptr + Module._getTraceEventsSize()));
+        const names = JSON.parse(json).traceEvents.map((e: { name: string }) => e.name);
+        expect(names).toContain('searchBuild');
+        expect(names).toContain('search');
+    });
+
+    it('renderer module', async () => {
+        expect(await loadRenderer()).toBe(window.RendererModule);
+        expect(window.RendererModule!._computeDays).toBeDefined();
+        // the core module does not link GLPK
+        expect(window.NativeModule._computeDays).toBeUndefined();
+        expect(window.RendererModule!._sWSearch).toBeUndefined();
+    });
+
+    it('memory budget', () => {
+        const searcher = new FastSearcher(['intro to data structures', 'data analysis']);
+        const memory = getEngineMemory();
+        expect(memory.categories.searchIndex.current).toBeGreaterThan(0);
+        expect(memory.peak).toBeGreaterThanOrEqual(memory.current);
+
+        // with a budget that is already used up, results are no longer cached.
+        // The renderer module is loaded, and takes a quarter of the budget
+        getEngineMemory(8, true);
+        // the low 32 bits of budgetBytes in EngineMemory
+        const budgetOf = (Module: EMModule) => Module.HEAPU32[Module._getMemoryStats() / 4 + 4];
+        expect(budgetOf(window.NativeModule)).toBe(6);
+        expect(budgetOf(window.RendererModule!)).toBe(2);
+        expect(searcher.sWSearch('data', 2).length).toBe(2);
+        const degraded = getEngineMemory(0, true);
+        expect(degraded.budget).toBe(8);
+        expect(degraded.uncachedResults).toBe(true);
+        expect(getEngineMemory().uncachedResults).toBe(false);
+    });
 });
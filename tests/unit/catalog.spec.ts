@@ -1,4 +1,44 @@
+import Catalog from '@/models/Catalog';
+import Course from '@/models/Course';
 import ProposedSchedule from '@/models/ProposedSchedule';
+import Section from '@/models/Section';
+
+/**
+ * a small catalog whose rankings can be worked out by hand,
+ * each course given as [key, title, description, [section id, topic, instructors][]]
+ */
+function smallCatalog(data: [string, string, string, [number, string, string[]][]][]) {
+    const courseDict: { [x: string]: Course } = Object.create(null);
+    const courses: Course[] = [];
+    const sections: Section[] = [];
+    for (const [key, title, description, secs] of data) {
+        const course: Course = Object.create(Course.prototype, {
+            key: { value: key, enumerable: true },
+            department: { value: key.replace(/\d+/, '').toUpperCase(), enumerable: true },
+            number: { value: +key.substring(key.length - 5, key.length - 1), enumerable: true },
+            type: { value: 'Lecture', enumerable: true },
+            title: { value: title, enumerable: true },
+            description: { value: description, enumerable: true },
+            sections: { value: [] as Section[] },
+            ids: { value: [] as number[], enumerable: true }
+        });
+        for (const [id, topic, instructors] of secs) {
+            const section: Section = Object.create(Section.prototype, {
+                course: { value: course },
+                key: { value: key, enumerable: true },
+                id: { value: id, enumerable: true },
+                topic: { value: topic, enumerable: true },
+                instructors: { value: instructors, enumerable: true }
+            });
+            course.sections.push(section);
+            course.ids.push(id);
+            sections.push(section);
+        }
+        courseDict[key] = course;
+        courses.push(course);
+    }
+    return new Catalog({ id: '0000', name: 'test' }, [courseDict, courses, sections], 0);
+}
 
 describe('catalog test', () => {
     it('search', () => {
@@ -20,6 +60,65 @@ describe('catalog test', () => {
         ).toBe(true);
     });
 
+    it('fuzzy search ranking', () => {
+        const catalog = smallCatalog([
+            [
+                'cs21505',
+                'Data Structures',
+                'Trees, heaps and hash tables',
+                [
+                    [10, '', ['Aaron Bloomfield']],
+                    [11, '', ['Mark Floryan']]
+                ]
+            ],
+            ['cs33305', 'Graph Theory', 'Graphs as data structures', [[20, '', ['Lisa Smith']]]],
+            [
+                'cs11105',
+                'Introduction to Programming',
+                'Programming in Python',
+                [[30, 'Data structures in Python', ['Raymond Pettit']]]
+            ],
+            ['phys24194', 'Physics Lab', 'Mechanics and waves', [[40, '', ['Bob Jones']]]]
+        ]);
+
+        // the score of a course is the sum of score ** 2 * weight over its matched fields (title 1, description 0.5),
+        // plus the mean of that of its matched sections (topic 0.9, instructors 0.25).
+        // a title match ranks above the same match in a section topic, which ranks above it in a description
+        let [courses, matches] = catalog.fuzzySearch('data structures');
+        expect(courses.map(c => c.key)).toEqual(['cs21505', 'cs11105', 'cs33305']);
+        // a course with a course match keeps all of its sections
+        expect(courses[0].ids).toEqual([10, 11]);
+        // fields with a score of 0 do not contribute any match
+        expect(matches[0][0]).toEqual([
+            { match: 'title', start: 0, end: 4 },
+            { match: 'title', start: 5, end: 15 }
+        ]);
+        expect(matches[0][1].size).toBe(0);
+        expect(matches[1][1].get(30)).toEqual([
+            { match: 'topic', start: 0, end: 4 },
+            { match: 'topic', start: 5, end: 15 }
+        ]);
+        expect(matches[2][0]).toEqual([
+            { match: 'description', start: 10, end: 14 },
+            { match: 'description', start: 15, end: 25 }
+        ]);
+
+        // typo tolerance is on: "lav" shares no trigram with "lab"
+        [courses, matches] = catalog.fuzzySearch('lav');
+        expect(courses.map(c => c.key)).toEqual(['phys24194']);
+        expect(matches[0][0]).toEqual([{ match: 'title', start: 8, end: 11 }]);
+
+        // a course found only through its sections keeps only the matched ones
+        [courses, matches] = catalog.fuzzySearch('bobb');
+        expect(courses.map(c => c.key)).toEqual(['phys24194']);
+        expect(courses[0].ids).toEqual([40]);
+        expect(matches[0][0]).toEqual([]);
+        expect(matches[0][1].get(40)).toEqual([{ match: 'instructors', start: 0, end: 3 }]);
+
+        // scores of 0.1 or less are dropped: an instructor match weighs 0.25
+        expect(catalog.fuzzySearch('jnes')[0]).toEqual([]);
+    });
+
     it('convert key', () => {
         const catalog = window.catalog;
         const schedule = new ProposedSchedule();
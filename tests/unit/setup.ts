@@ -81,6 +81,7 @@ beforeAll(async () => {
     const store = new Store();
     await store.semester.loadSemesters();
     window.NativeModule = await require('../../public/js/wasm_modules.js')();
+    window.RendererModule = await require('../../public/js/wasm_renderer.js')();
     const catalog = await dataend.courses({ name: '', id: '1198' });
     const section = Object.create(Section.prototype, {
         course: {